@@ -1,37 +1,585 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ptrace.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/sendfile.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #define MAX_INPUT_SIZE 1024
-#define MAX_ARGS 64
-
-typedef struct {
-    int progress;
-    char locations[6][32];
-    char suspect[6][32];
-    char suspect_locations[6][32];
-    char weapon[32];
-    char motive[128];
-    int correct_suspect;
-    int evidence_found;
-    int interviews_done[6];
+#define RING_SIZE 65536
+#define PROCESS_CAP_MAX 4096
+#define PROCESS_CAP_MARGIN 16
+
+#define SESSION_ROOT "sessions"
+#define SESSION_HIGH_WATER (1 << 20)
+#define SESSION_MAX_LINE (1 << 20)
+#define RENDER_IOV 64
+#define RENDER_FLUSH (1 << 16)
+#define SERVER_EVENTS 64
+
+#define CASE_SOLVED 0
+#define CASE_UNSOLVED 1
+#define CASE_ABANDONED 2
+#define CASE_OPEN 3
+
+#define CASE_DIR "cases"
+#define CASE_MAX_LOCATIONS 256
+#define CASE_MAX_SUSPECTS 256
+#define CASE_MAX_STEPS 256
+#define CASE_NONE 0xffffffffu
+#define PACK_MAGIC 0x4b434150
+#define PACK_VERSION 2
+#define DIALOGUE_MAX_DEPTH 8
+#define ARENA_BLOCK 4096
+
+typedef struct {
+    char *pool;
+    size_t used;
+    size_t cap;
+    unsigned int *slots;
+    size_t slot_count;
+    size_t count;
+} StringTable;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int size;
+    unsigned int checksum;
+    unsigned int name;
+    unsigned int title;
+    unsigned int intro;
+    unsigned int victim;
+    unsigned int weapon;
+    unsigned int motive;
+    unsigned int culprit;
+    unsigned int location_count;
+    unsigned int suspect_count;
+    unsigned int evidence_count;
+    unsigned int step_count;
+    unsigned int line_count;
+    unsigned int locations;
+    unsigned int suspects;
+    unsigned int evidence;
+    unsigned int steps;
+    unsigned int lines;
+} PackHeader;
+
+typedef struct {
+    unsigned int name;
+    unsigned int detail;
+} PackLocation;
+
+typedef struct {
+    unsigned int name;
+    unsigned int alias;
+    unsigned int role;
+    unsigned int location;
+    unsigned int lines;
+    unsigned int line_count;
+} PackSuspect;
+
+typedef struct {
+    unsigned int name;
+    unsigned int file;
+    unsigned int content;
+    unsigned int note;
+} PackEvidence;
+
+typedef struct {
+    unsigned int text;
+    unsigned int reveals;
+} PackStep;
+
+typedef enum {
+    DIALOGUE_SAYS,
+    DIALOGUE_TELL,
+    DIALOGUE_NOTE,
+    DIALOGUE_PRESS
+} DialogueKind;
+
+typedef struct {
+    unsigned int kind;
+    unsigned int depth;
+    unsigned int text;
+    unsigned int evidence;
+} PackLine;
+
+typedef struct DialogueNode {
+    const PackLine *line;
+    struct DialogueNode *child;
+    struct DialogueNode *next;
+} DialogueNode;
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *blocks;
+    size_t bytes;
+    size_t objects;
+} Arena;
+
+#define GEN_TRAITS 4
+#define GEN_MAX_LOCATIONS 8
+#define GEN_MAX_SUSPECTS 8
+#define GEN_MIN_EVIDENCE 2
+
+typedef struct {
+    unsigned long long seed;
+    int location_count;
+    int suspect_count;
+    int evidence_count;
+    int culprit;
+    int victim;
+    int weapon;
+    int motive;
+    int locations[GEN_MAX_LOCATIONS];
+    int first[GEN_MAX_SUSPECTS];
+    int last[GEN_MAX_SUSPECTS];
+    int nickname[GEN_MAX_SUSPECTS];
+    int role[GEN_MAX_SUSPECTS];
+    int location[GEN_MAX_SUSPECTS];
+    int traits[GEN_MAX_SUSPECTS][GEN_TRAITS];
+    int evidence[GEN_TRAITS];
+} GenCase;
+
+#define SOLVER_MAX_STATES (1 << 22)
+#define SOLVER_MAX_DEPTH 4096
+#define SOLVER_CHUNK 256
+#define SOLVER_START 0
+#define SOLVER_INVESTIGATE 1
+#define SOLVER_MOVE 2
+#define SOLVER_INTERVIEW 3
+
+#define BENCH_MIN_NS 50000000ULL
+#define BENCH_MAX_ITERATIONS 100000000L
+#define BENCH_TRACE_OPS 16
+#define BENCH_TRACE_THREADS 64
+
+#define RESOLVE_NONE -1
+#define RESOLVE_AMBIGUOUS -2
+#define RESOLVE_SHOWN 6
+
+typedef struct {
+    int child;
+    int sibling;
+    int exact;
+    int subtree;
+    int entries;
+    unsigned char ch;
+} TrieNode;
+
+typedef struct {
+    int entity;
+    int next;
+} TrieEntry;
+
+typedef struct {
+    TrieNode *nodes;
+    int count;
+    int cap;
+    TrieEntry *entries;
+    int entry_count;
+    int entry_cap;
+} Trie;
+
+#define COMPLETE_COMMAND 1
+#define COMPLETE_SUSPECT 2
+#define COMPLETE_LOCATION 4
+#define COMPLETE_EVIDENCE 8
+#define COMPLETE_FILE 16
+#define COMPLETE_JOINED 32
+#define COMPLETE_SHOWN 64
+#define COMPLETE_BENCH_WORDS 20000
+#define HISTORY_SIZE 1000
+
+typedef struct {
+    char *text;
+    int kinds;
+} CompletionWord;
+
+typedef struct {
+    Trie trie;
+    CompletionWord *words;
+    int count;
+    int cap;
+} Completer;
+
+#define BIT_TEST(set, i) ((set)[(i) >> 3] & (1 << ((i) & 7)))
+#define BIT_SET(set, i) ((set)[(i) >> 3] |= 1 << ((i) & 7))
+
+typedef struct {
+    unsigned short progress;
+    unsigned char evidence[CASE_MAX_STEPS / 8];
+    unsigned char interviewed[CASE_MAX_SUSPECTS / 8];
 } GameState;
 
-GameState game;
+typedef struct {
+    GameState state;
+    unsigned char action;
+    unsigned char dead;
+    unsigned short arg;
+    int parent;
+} SolverNode;
+
+typedef struct {
+    SolverNode *nodes;
+    unsigned int *slots;
+    size_t slot_mask;
+    int max_nodes;
+    int count;
+    int level_end;
+    int next;
+    int goal;
+    int overflow;
+    int done;
+    unsigned long long expanded;
+    pthread_barrier_t start;
+    pthread_barrier_t finish;
+} Solver;
+
+#define SAVE_DIR "saves"
+#define JOURNAL_FILE "journal"
+#define SNAPSHOT_MAGIC 0x524f4e53
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_FILES 16
+#define SNAPSHOT_BODY offsetof(Snapshot, size)
+
+typedef struct {
+    char name[32];
+    unsigned int offset;
+    unsigned int length;
+} SnapshotEntry;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int checksum;
+    unsigned int size;
+    unsigned int file_count;
+    unsigned int scenario;
+    GameState game;
+    SnapshotEntry files[SNAPSHOT_FILES];
+} Snapshot;
+
+#define TRANSCRIPT_MAGIC 0x52544f4e
+#define TRANSCRIPT_VERSION 1
+#define TRANSCRIPT_CHECKPOINT 1024
+#define TRANSCRIPT_STRING 1
+#define TRANSCRIPT_COMMAND 2
+#define TRANSCRIPT_CHECKPOINT_STATE 3
+#define TRANSCRIPT_RESTORE 4
+#define REPLAY_ACCUSE 4
+#define REPLAY_EXIT 5
+#define REPLAY_UNRESOLVED -3
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int pack;
+    unsigned int state_size;
+} TranscriptHeader;
+
+typedef struct {
+    FILE *file;
+    StringTable strings;
+    unsigned long long step;
+    unsigned long long started;
+    unsigned long long last_us;
+    pthread_mutex_t lock;
+} Recorder;
+
+typedef struct {
+    unsigned int name;
+    unsigned int arg;
+} ReplayCommand;
+
+typedef struct {
+    size_t step;
+    int restore;
+    GameState state;
+} ReplayMark;
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    char *pool;
+    size_t pool_used;
+    ReplayCommand *commands;
+    size_t count;
+    ReplayMark *marks;
+    size_t mark_count;
+    unsigned long long elapsed_us;
+    int diverged;
+} Replay;
+
+#define OP_NONE 0
+#define OP_PIPE 1
+#define OP_BACKGROUND 2
+#define OP_IN 3
+#define OP_OUT 4
+#define OP_APPEND 5
+#define OP_ERR 6
+#define OP_ERR_APPEND 7
+#define OP_BOTH 8
+#define OP_ERR_TO_OUT 9
+#define OP_COUNT 9
+
+static const char operator_text[OP_COUNT][5] = {"|", "&", "<", ">", ">>", "2>", "2>>", "&>", "2>&1"};
+
+typedef struct {
+    char **argv;
+    size_t count;
+    size_t cap;
+} Tokens;
+
+#define EVIDENCE_NAME 64
+#define EVIDENCE_MAX_FILE (1 << 20)
+#define STREAM_CHUNK 65536
+#define STREAM_RELEASE (8 << 20)
+#define SEARCH_TERM 64
+#define SEARCH_MAX_TERMS 16
+#define SEARCH_SHOWN 20
+#define SEARCH_COMPACT 1024
+#define SEARCH_BENCH_DOCS 20000
+
+typedef struct {
+    int refs;
+    size_t len;
+    char data[];
+} EvidenceBlob;
+
+typedef struct EvidenceJob EvidenceJob;
+
+typedef struct {
+    char *term;
+    unsigned int hash;
+    unsigned int *docs;
+    int count;
+    int cap;
+} SearchTerm;
+
+typedef struct {
+    char name[EVIDENCE_NAME];
+    EvidenceBlob *blob;
+    const char *text;
+    int suspect;
+    int live;
+} SearchDoc;
+
+typedef struct {
+    SearchTerm *terms;
+    unsigned int term_cap;
+    unsigned int term_count;
+    SearchDoc *docs;
+    int doc_count;
+    int doc_cap;
+    int dead;
+} SearchIndex;
+
+
+typedef struct {
+    char name[EVIDENCE_NAME];
+    EvidenceBlob *blob;
+    EvidenceJob *job;
+    int pending;
+    int stale;
+    int unsynced;
+    int doc;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} EvidenceEntry;
+
+typedef struct {
+    EvidenceEntry *entries;
+    int count;
+    int cap;
+    int open;
+    int dir_fd;
+    int watch_fd;
+    int pending;
+    int error;
+    SearchIndex index;
+} EvidenceStore;
 
+struct EvidenceJob {
+    EvidenceJob *next;
+    EvidenceStore *store;
+    int entry;
+    char name[EVIDENCE_NAME];
+    EvidenceBlob *blob;
+    int dir_fd;
+    int error;
+    struct stat st;
+};
+
+typedef struct {
+    const char *data;
+    size_t off;
+    size_t len;
+} RenderSegment;
+
+typedef struct {
+    char *text;
+    size_t used;
+    size_t cap;
+    RenderSegment *segs;
+    int count;
+    int segcap;
+    int next;
+    size_t sent;
+    size_t len;
+} RenderBuffer;
+
+typedef struct {
+    GameState game;
+    char case_dir[128];
+    int running;
+    int outcome;
+    int use_color;
+    int show_prompt;
+    int remote;
+    int journal;
+    Recorder *recorder;
+    EvidenceStore store;
+    unsigned long id;
+    int fd;
+    int epfd;
+    int closing;
+    Tokens tokens;
+    char *inbuf;
+    size_t inlen;
+    size_t incap;
+    int discarding;
+    RenderBuffer render;
+    FILE *out;
+} Session;
+
+const PackHeader *pack;
+const PackLocation *pack_locations;
+const PackSuspect *pack_suspects;
+const PackEvidence *pack_evidence;
+const PackStep *pack_steps;
+const PackLine *pack_lines;
+Arena dialogue_arena;
+DialogueNode **dialogue_trees;
+pthread_mutex_t dialogue_lock = PTHREAD_MUTEX_INITIALIZER;
+Trie suspect_names;
+Trie location_names;
+Trie evidence_names;
+Completer completer;
+pthread_mutex_t completion_lock = PTHREAD_MUTEX_INITIALIZER;
+SearchIndex dialogue_index;
+Session local_session;
+int batch_mode = 0;
+
+__thread Session *session;
+FILE *server_null_in;
+char server_socket_path[108];
+
+__thread FILE *sh_in;
+__thread FILE *sh_out;
+__thread FILE *sh_err;
+
+typedef struct {
+    char data[RING_SIZE];
+    size_t head;
+    size_t tail;
+    int writer_closed;
+    int reader_closed;
+    int refs;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} RingBuffer;
+
+unsigned int checksum32(const void *data, size_t size);
+unsigned int intern_string(StringTable *table, const char *text);
+unsigned char *compile_case(const char *text, size_t *pack_size, char *error, size_t error_size);
+int compile_case_file(const char *source, const char *target);
+int use_pack(const unsigned char *data, size_t size, const char *source);
+int load_case(const char *name);
+const char *pack_string(unsigned int offset);
+void trie_add_name(Trie *trie, const char *name, int entity);
+int trie_lookup(const Trie *trie, const char *query);
+int resolve_name(const Trie *trie, const char *query, const char *(*name_of)(unsigned int));
+const char *suspect_name(unsigned int i);
+const char *location_name(unsigned int i);
+const char *evidence_name(unsigned int i);
+void build_resolvers();
+int solve_case(const char *script_path);
+void generate_case(unsigned long long seed, GenCase *c);
+const char *check_case(const GenCase *c);
+char *case_to_text(const GenCase *c);
+void run_gencases(int total, unsigned long long seed, const char *dir);
+int load_generated_case(unsigned long long seed);
+char *join_args(char **args);
 void init_game();
+int save_snapshot(const char *slot);
+int load_snapshot(const char *slot);
+void journal_open(const char *base);
+void journal_append(char **args);
+void resume_session();
+int game_investigate(GameState *game);
+void game_move(GameState *game, int location);
+int game_interview(GameState *game, int suspect);
+int recorder_start(const char *path);
+void recorder_stop();
+void recorder_command(char **args, const char *name);
+void recorder_restored();
+int load_replay(const char *path, Replay *replay);
+int run_replay(Replay *replay, size_t target, int seek, GameState *state);
+int replay_transcript(const char *path, const char *at);
+void run_bench(const char *filter, const char *output, const char *transcript);
 void print_prompt();
-void parse_input(char *input, char **args);
+int parse_input(char *line, size_t len, Tokens *tokens);
+int operator_kind(const char *arg);
 void execute_command(char **args);
 void print_welcome_message();
 void handle_investigate();
 void handle_interview(char *suspect);
+void dialogue_reset();
 void handle_accuse(char *suspect);
 void print_ending(int correct);
 void create_case_files();
@@ -40,599 +588,7333 @@ void handle_move(char *location);
 void print_case_status();
 void handle_whereis(char *suspect);
 void create_case_file(const char *filename, const char *content);
-void handle_redirection(char **args);
+void evidence_open(EvidenceStore *store, const char *dir);
+void evidence_close(EvidenceStore *store);
+void evidence_flush(EvidenceStore *store);
+void evidence_drop(EvidenceStore *store);
+int evidence_put(EvidenceStore *store, const char *name, const char *content, size_t len);
+int search_add(SearchIndex *index, const char *name, EvidenceBlob *blob, const char *text, int suspect);
 void execute_with_pipe(char **args);
+void start_job(char **args);
 void demonstrate_exec();
 void demonstrate_waitpid();
 void demonstrate_execvp();
-void controlled_forkbomb();
+void controlled_forkbomb(int count);
+int process_cap();
+void run_spawnbench(int total, int concurrency, const char *only);
+void cmd_spawnbench(char **args);
+void run_streambench(int megabytes);
+void cmd_streambench(char **args);
+int run_server(const char *path, int workers);
+void init_tool_modes();
+int tool_is_external(const char *name);
+void handle_tool(char **args);
+void case_path(char *buf, size_t size, const char *filename);
+int session_path(char *buf, size_t size, const char *name);
+int case_file_path(char *buf, size_t size, const char *name);
+int native_cat(const char *path);
+int native_rev(const char *path);
+int native_ls(const char *dir);
+int native_du(const char *dir);
+int native_date();
+void show_case_file(const char *filename);
+
+void run_command_line(char **args);
+static unsigned long long now_ns();
+void sh_printf(const char *fmt, ...);
+void sh_perror(const char *msg);
+void sh_flush();
+
+typedef enum {
+    STYLE_ALERT,
+    STYLE_GOOD,
+    STYLE_HEADING,
+    STYLE_BANNER,
+    STYLE_STATUS,
+    STYLE_SPEAKER
+} Style;
+
+const char *style_codes[] = {"\033[1;31m", "\033[1;32m", "\033[1;33m", "\033[1;34m", "\033[1;35m", "\033[1;36m"};
+
+typedef struct {
+    char *text[2];
+    size_t len[2];
+} Screen;
+
+Screen welcome_screen;
+Screen help_screens[2];
+pthread_mutex_t screen_lock = PTHREAD_MUTEX_INITIALIZER;
+__thread int screen_color = -1;
+
+void sh_styled(Style style, const char *fmt, ...);
+static FILE *session_stream(Session *s);
+static void render_at_exit();
+static int same_file(int a, int b);
+pid_t spawn_process(char **argv, int in_fd, int out_fd, int err_fd);
+int run_external(char **argv);
+int run_external_tool(const char *tool, const char *arg);
+int external_tool_argv(const char *tool, const char *arg, char **argv, char *path, size_t size);
+FILE *ring_open(RingBuffer *ring, const char *mode);
+void init_launcher();
+void cmd_launcher(char **args);
+
+typedef enum {
+    LAUNCH_SPAWN,
+    LAUNCH_VFORK,
+    LAUNCH_FORK
+} LaunchMode;
+
+const char *launch_mode_names[] = {"spawn", "vfork", "fork"};
+LaunchMode launch_mode = LAUNCH_SPAWN;
+
+typedef void (*CommandHandler)(char **args);
+
+#define ARGS_ANY -1
+#define MAX_COMMANDS 64
+#define COMMAND_SLOTS 256
+#define CMD_LOCAL_ONLY 1
+#define CMD_JOURNAL 2
+#define CMD_RESTORES 4
+
+typedef struct {
+    const char *name;
+    CommandHandler handler;
+    int min_args;
+    int max_args;
+    const char *usage;
+    const char *help;
+    int flags;
+    int complete;
+} Command;
+
+typedef struct {
+    char **argv;
+    Session *session;
+    const Command *builtin;
+    FILE *in;
+    FILE *out;
+    FILE *err;
+    int in_fd;
+    int out_fd;
+    int spill_fd;
+    pid_t pid;
+    pthread_t thread;
+    int threaded;
+    int finished;
+    int stopped;
+    int owns_in;
+    int owns_out;
+    int owns_err;
+    char *in_file;
+    char *out_file;
+    char *err_file;
+    int out_append;
+    int err_append;
+    int err_to_out;
+    char *tool_argv[4];
+    char tool_path[256];
+} Stage;
+
+int handle_redirection(Stage *stage);
+
+typedef enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+typedef struct Job {
+    struct Job *next;
+    int id;
+    pid_t pgid;
+    pid_t last_pid;
+    JobState state;
+    JobState shown;
+    int status;
+    Stage *stages;
+    int count;
+    char **args;
+    char **argv;
+    char *command;
+} Job;
+
+Job *job_list = NULL;
+int job_signal_fd = -1;
+int job_wake_fd = -1;
+int job_control = 0;
+pid_t shell_pgid;
+sigset_t launch_mask;
+
+void jobs_init();
+void report_jobs();
+void wait_for_input();
+int editor_init();
+ssize_t edit_line(char **line, size_t *line_cap);
+void jobs_shutdown();
+
+void init_commands();
+int register_command(const Command *cmd);
+const Command *find_command(const char *name);
+void cmd_investigate(char **args);
+void cmd_interview(char **args);
+void cmd_accuse(char **args);
+void cmd_examine(char **args);
+void cmd_move(char **args);
+void cmd_whereis(char **args);
+void cmd_status(char **args);
+void cmd_help(char **args);
+void cmd_ls(char **args);
+void cmd_cd(char **args);
+void cmd_cat(char **args);
+void cmd_forkbomb(char **args);
+void cmd_mv(char **args);
+void cmd_du(char **args);
+void cmd_date(char **args);
+void cmd_rev(char **args);
+void cmd_tool(char **args);
+void cmd_execdemo(char **args);
+void cmd_waitdemo(char **args);
+void cmd_execvpdemo(char **args);
+void cmd_gencases(char **args);
+void cmd_solve(char **args);
+void cmd_save(char **args);
+void cmd_load(char **args);
+void cmd_sync(char **args);
+void cmd_search(char **args);
+void cmd_record(char **args);
+void cmd_replay(char **args);
+void cmd_bench(char **args);
+void cmd_stats(char **args);
+void cmd_trace(char **args);
+void cmd_jobs(char **args);
+void cmd_fg(char **args);
+void cmd_bg(char **args);
+void cmd_wait(char **args);
+void cmd_exit(char **args);
+
+const Command builtin_commands[] = {
+    {"investigate", cmd_investigate, 0, 0, NULL, "Search for clues", CMD_JOURNAL, 0},
+    {"interview", cmd_interview, 1, ARGS_ANY, "[name]", "Question suspects", CMD_JOURNAL, COMPLETE_SUSPECT | COMPLETE_JOINED},
+    {"examine", cmd_examine, 1, ARGS_ANY, "[file]", "Review evidence", 0, COMPLETE_EVIDENCE | COMPLETE_JOINED},
+    {"move", cmd_move, 1, ARGS_ANY, "[location]", "Go to another location", CMD_JOURNAL, COMPLETE_LOCATION | COMPLETE_JOINED},
+    {"whereis", cmd_whereis, 1, ARGS_ANY, "[suspect]", "Find a suspect's location", 0, COMPLETE_SUSPECT | COMPLETE_JOINED},
+    {"search", cmd_search, 1, ARGS_ANY, "[terms]", "Find evidence and interview lines that mention every term", 0, COMPLETE_SUSPECT | COMPLETE_LOCATION | COMPLETE_EVIDENCE},
+    {"accuse", cmd_accuse, 1, ARGS_ANY, "[name]", "Make your final charge", 0, COMPLETE_SUSPECT | COMPLETE_JOINED},
+    {"status", cmd_status, 0, 0, NULL, "Show case progress", 0, 0},
+    {"gencases", cmd_gencases, 0, 3, "[count] [seed] [directory]", "Generate random solvable cases and report cases/sec", CMD_LOCAL_ONLY, 0},
+    {"solve", cmd_solve, 0, 1, "[script]", "Search for the shortest way to close the case and print it as a script", CMD_LOCAL_ONLY, 0},
+    {"save", cmd_save, 0, 1, "[slot]", "Save the case to a slot (quicksave by default)", CMD_LOCAL_ONLY, 0},
+    {"load", cmd_load, 0, 1, "[slot]", "Restore a saved case", CMD_LOCAL_ONLY | CMD_RESTORES, 0},
+    {"sync", cmd_sync, 0, 0, NULL, "Write pending case files to disk and fsync them", 0, 0},
+    {"record", cmd_record, 0, 1, "[file|stop]", "Record every command to a transcript file", CMD_LOCAL_ONLY, 0},
+    {"replay", cmd_replay, 1, 2, "[file] [step]", "Fast-forward through a transcript, optionally stopping at a step", CMD_LOCAL_ONLY | CMD_RESTORES, 0},
+    {"bench", cmd_bench, 0, 3, "[filter|all] [output.json] [transcript]", "Benchmark parsing, dispatch, builtins and whole sessions; prints JSON", CMD_LOCAL_ONLY, 0},
+    {"stats", cmd_stats, 0, 1, "[reset]", "Show per-command latency percentiles and I/O counters", 0, 0},
+    {"trace", cmd_trace, 0, 2, "[on [file]|off]", "Write a Chrome trace of every command", CMD_LOCAL_ONLY, 0},
+    {"forkbomb", cmd_forkbomb, 0, 1, "[count]", "Controlled fork bomb demonstration (10 by default, capped by process limits)", CMD_LOCAL_ONLY, 0},
+    {"spawnbench", cmd_spawnbench, 0, 3, "[count] [concurrency] [method]", "Compare fork, vfork, posix_spawn and clone", CMD_LOCAL_ONLY, 0},
+    {"streambench", cmd_streambench, 0, 1, "[megabytes]", "Compare built-in and system cat/rev throughput", CMD_LOCAL_ONLY, 0},
+    {"mv", cmd_mv, 2, 2, "[source] [destination]", "Move a file", 0, 0},
+    {"du", cmd_du, 0, 0, NULL, "Show disk usage of the case files", 0, 0},
+    {"date", cmd_date, 0, 0, NULL, "Show the current date and time", 0, 0},
+    {"rev", cmd_rev, 0, 1, "[file]", "Reverse each line of a case file", 0, 0},
+    {"ls", cmd_ls, 0, ARGS_ANY, NULL, "List the case files", 0, 0},
+    {"cd", cmd_cd, 1, 1, "[directory]", "Change directory", CMD_LOCAL_ONLY, 0},
+    {"cat", cmd_cat, 0, 1, "[file]", "Print a case file", 0, 0},
+    {"tool", cmd_tool, 0, 2, "[name] [native|external]", "Switch a tool between built-in and system versions", CMD_LOCAL_ONLY, 0},
+    {"launcher", cmd_launcher, 0, 1, "[spawn|vfork|fork]", "Choose how external programs are started", CMD_LOCAL_ONLY, 0},
+    {"jobs", cmd_jobs, 0, 0, NULL, "List background jobs and their exit status", CMD_LOCAL_ONLY, 0},
+    {"fg", cmd_fg, 0, 1, "[%job]", "Bring a background or stopped job to the foreground", CMD_LOCAL_ONLY, 0},
+    {"bg", cmd_bg, 0, 1, "[%job]", "Resume a stopped job in the background", CMD_LOCAL_ONLY, 0},
+    {"wait", cmd_wait, 0, 1, "[%job]", "Wait for background jobs to finish", CMD_LOCAL_ONLY, 0},
+    {"execdemo", cmd_execdemo, 0, 0, NULL, NULL, CMD_LOCAL_ONLY, 0},
+    {"waitdemo", cmd_waitdemo, 0, 0, NULL, NULL, CMD_LOCAL_ONLY, 0},
+    {"execvpdemo", cmd_execvpdemo, 0, 0, NULL, NULL, CMD_LOCAL_ONLY, 0},
+    {"help", cmd_help, 0, ARGS_ANY, NULL, "Show this message", 0, COMPLETE_COMMAND},
+    {"exit", cmd_exit, 0, ARGS_ANY, NULL, "Quit the game", 0, 0},
+    {NULL, NULL, 0, 0, NULL, NULL, 0, 0}
+};
+
+const Command *commands[MAX_COMMANDS];
+int command_count = 0;
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BIT 47
+#define HIST_BUCKETS ((HIST_MAX_BIT - HIST_SUB_BITS + 2) * HIST_SUB)
+#define STAT_PIPELINE MAX_COMMANDS
+#define STAT_REDIRECT (MAX_COMMANDS + 1)
+#define STAT_SPAWN (MAX_COMMANDS + 2)
+#define STAT_WAIT (MAX_COMMANDS + 3)
+#define STAT_SLOTS (MAX_COMMANDS + 4)
+#define STAT_ADD(field, n) __atomic_fetch_add(&stat_counters.field, (n), __ATOMIC_RELAXED)
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long total;
+    unsigned long long max;
+    unsigned long long buckets[HIST_BUCKETS];
+} Histogram;
+
+typedef struct {
+    unsigned long long forks;
+    unsigned long long execs;
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    unsigned long long files_created;
+} StatCounters;
+
+const char *stat_phase_names[] = {"(pipeline)", "(redirect)", "(spawn)", "(wait)"};
+Histogram histograms[STAT_SLOTS];
+StatCounters stat_counters;
+unsigned long long startup_ns;
+int trace_fd = -1;
+unsigned long trace_events;
+unsigned long long trace_epoch;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void stat_record(int slot, const char *name, unsigned long long begin);
+int command_slot(const Command *cmd);
+void print_stats();
+int trace_start(const char *path);
+void trace_stop();
+const Command *command_slots[COMMAND_SLOTS];
+unsigned int command_seed = 0;
+
+typedef struct {
+    const char *name;
+    int external;
+} ToolMode;
+
+ToolMode tool_modes[] = {
+    {"cat", 0},
+    {"rev", 0},
+    {"ls", 0},
+    {"du", 0},
+    {"date", 0},
+    {"examine", 0},
+    {NULL, 0}
+};
+
+int main(int argc, char **argv) {
+    unsigned long long launched = now_ns();
+    char *line = NULL;
+    size_t line_cap = 0;
+    FILE *script = stdin;
+    const char *server_path = NULL;
+    int workers = 0;
+    int resume = 0;
+    const char *case_name = NULL;
+    const char *random_seed = NULL;
+    const char *solve_script = NULL;
+    int solve = 0;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    const char *replay_step = NULL;
+    char *bench_args[4] = {NULL};
+    int bench = 0;
+
+    session = &local_session;
+    session->journal = -1;
+    snprintf(session->case_dir, sizeof(session->case_dir), "case_files");
+    session->running = 1;
+    session->outcome = CASE_OPEN;
+    session->use_color = isatty(STDOUT_FILENO) && getenv("NO_COLOR") == NULL;
+    session->show_prompt = 1;
+    session->fd = STDOUT_FILENO;
+    session->out = session_stream(session);
+    sh_in = stdin;
+    sh_out = session->out ? session->out : stdout;
+    sh_err = stderr;
+    if (isatty(STDOUT_FILENO) && same_file(STDOUT_FILENO, STDERR_FILENO)) {
+        sh_err = sh_out;
+    }
+    atexit(render_at_exit);
+    signal(SIGPIPE, SIG_IGN);
+
+    init_commands();
+    init_tool_modes();
+    init_launcher();
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--spawnbench") == 0) {
+            char *spec = i + 1 < argc ? argv[i + 1] : "1000";
+            char *colon = strchr(spec, ':');
+            run_spawnbench(atoi(spec), colon ? atoi(colon + 1) : 1, i + 2 < argc ? argv[i + 2] : NULL);
+            return 0;
+        }
+        if (strcmp(argv[i], "--streambench") == 0) {
+            run_streambench(i + 1 < argc ? atoi(argv[i + 1]) : 64);
+            return 0;
+        }
+        if (strcmp(argv[i], "--compile-case") == 0 && i + 1 < argc) {
+            return compile_case_file(argv[i + 1], i + 2 < argc ? argv[i + 2] : NULL);
+        }
+        if (strcmp(argv[i], "--gencases") == 0) {
+            char *spec = i + 1 < argc ? argv[i + 1] : "1000";
+            char *colon = strchr(spec, ':');
+            run_gencases(atoi(spec), colon ? strtoull(colon + 1, NULL, 10) : (unsigned long long)time(NULL),
+                         i + 2 < argc ? argv[i + 2] : NULL);
+            sh_flush();
+            return 0;
+        }
+        if (strcmp(argv[i], "--solve") == 0) {
+            solve = 1;
+            solve_script = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : NULL;
+        }
+        if (strcmp(argv[i], "--random") == 0) {
+            random_seed = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : "";
+        }
+        if (strcmp(argv[i], "--case") == 0 && i + 1 < argc) {
+            case_name = argv[++i];
+        }
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            script = fopen(argv[++i], "r");
+            if (script == NULL) {
+                perror(argv[i]);
+                return CASE_OPEN;
+            }
+            batch_mode = 1;
+        }
+        if (strcmp(argv[i], "--server") == 0) {
+            server_path = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : "noire.sock";
+        }
+        if (strcmp(argv[i], "--resume") == 0) {
+            resume = 1;
+        }
+        if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+            for (int j = 1; j < 4 && i + 1 < argc && argv[i + 1][0] != '-'; j++) {
+                bench_args[j] = argv[++i];
+            }
+        }
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            if (trace_start(argv[++i])) return CASE_OPEN;
+        }
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        }
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+            replay_step = i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]) ? argv[++i] : NULL;
+        }
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        }
+    }
+
+    if (random_seed) {
+        unsigned long long seed = *random_seed ? strtoull(random_seed, NULL, 10) : (unsigned long long)time(NULL);
+        if (load_generated_case(seed)) {
+            return CASE_OPEN;
+        }
+    } else if (load_case(case_name)) {
+        return CASE_OPEN;
+    }
+    build_resolvers();
+    init_game();
+
+    if (solve) {
+        int result = solve_case(solve_script);
+        sh_flush();
+        return result == 0 ? 0 : 1;
+    }
+
+    if (bench) {
+        bench_args[0] = "bench";
+        cmd_bench(bench_args);
+        sh_flush();
+        return 0;
+    }
+
+    if (replay_path) {
+        int result = replay_transcript(replay_path, replay_step);
+        sh_flush();
+        return result == 0 ? 0 : 1;
+    }
+
+    if (server_path) {
+        startup_ns = now_ns() - launched;
+        int result = run_server(server_path, workers);
+        trace_stop();
+        return result;
+    }
+
+    if (!isatty(fileno(script))) {
+        batch_mode = 1;
+    }
+    if (batch_mode) {
+        session->show_prompt = 0;
+        session->use_color = 0;
+    }
+
+    jobs_init();
+    create_case_files();
+    print_welcome_message();
+    if (resume) {
+        resume_session();
+    } else if (!batch_mode) {
+        journal_open("new");
+    }
+    if (record_path && recorder_start(record_path)) {
+        return CASE_OPEN;
+    }
+    startup_ns = now_ns() - launched;
+
+    int line_editing = job_control && editor_init() == 0;
+    while (session->running) {
+        report_jobs();
+        print_prompt();
+        ssize_t len;
+        if (line_editing) {
+            len = edit_line(&line, &line_cap);
+        } else {
+            if (job_control) wait_for_input();
+            len = getline(&line, &line_cap, script);
+        }
+        if (len == -1) break;
+        if (parse_input(line, len, &session->tokens) == 0) {
+            run_command_line(session->tokens.argv);
+        }
+    }
+    free(line);
+
+    jobs_shutdown();
+    evidence_close(&session->store);
+    recorder_stop();
+    trace_stop();
+    sh_flush();
+    return session->outcome;
+}
+
+void create_case_file(const char *filename, const char *content) {
+    char path[256];
+    if (evidence_put(&session->store, filename, content, strlen(content)) == 0) {
+        STAT_ADD(files_created, 1);
+        STAT_ADD(bytes_written, strlen(content));
+        return;
+    }
+    case_path(path, sizeof(path), filename);
+    
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        sh_printf("Error creating %s: %s\n", filename, strerror(errno));
+        return;
+    }
+    fprintf(fp, "%s", content);
+    fclose(fp);
+    STAT_ADD(files_created, 1);
+    STAT_ADD(bytes_written, strlen(content));
+}
+
+int session_path(char *buf, size_t size, const char *name) {
+    if (!session->remote) {
+        snprintf(buf, size, "%s", name);
+        return 0;
+    }
+    if (strchr(name, '/') || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        fprintf(sh_err, "%s: only case file names are allowed in server sessions\n", name);
+        return -1;
+    }
+    case_path(buf, size, name);
+    return 0;
+}
+
+void case_path(char *buf, size_t size, const char *filename) {
+    snprintf(buf, size, "%s/%s", session->case_dir, filename);
+}
+
+/* Resolves a file argument of cat, rev or examine; server sessions may only name their own case files. */
+int case_file_path(char *buf, size_t size, const char *name) {
+    if (session->remote) return session_path(buf, size, name);
+    case_path(buf, size, name);
+    return 0;
+}
+
+const char default_case_text[] =
+    "# The original LA Noire case, used when no --case pack is given\n"
+    "case la-noire\n"
+    "title LA NOIRE MURDER MYSTERY\n"
+    "intro October 1947. A gunshot echoes through\n"
+    "intro the foggy streets. Another body in the\n"
+    "intro war between the gangs and the vice lords.\n"
+    "victim Johnny 'Rats' Malone\n"
+    "weapon a .38 snubnose\n"
+    "motive The victim knew about Victoria's drug operation and was blackmailing her\n"
+    "\n"
+    "location Police Station\n"
+    "location Crime Scene\n"
+    "location Velvet Nightclub\n"
+    "location Docks\n"
+    "location Roosevelt Hotel\n"
+    "  detail A worn ledger sits at the front desk\n"
+    "location City Morgue\n"
+    "  detail The smell of antiseptic hangs in the air\n"
+    "\n"
+    "suspect Tony 'Fingers' Moretti\n"
+    "  alias Tony\n"
+    "  role bookie\n"
+    "  at Velvet Nightclub\n"
+    "  says I was playing poker at the Tropicana!\n"
+    "  says Me? Hurt someone? I'm a lover, not a fighter!\n"
+    "  says Victoria? She's been acting real jumpy lately...\n"
+    "  press ledger Johnny's ledger says somebody owed Vixen five grand.\n"
+    "    says Not me. Johnny was the one in hock to her, and she wanted it back.\n"
+    "  end\n"
+    "suspect Victoria 'Vixen' LaRue\n"
+    "  alias Victoria\n"
+    "  role club owner\n"
+    "  at Velvet Nightclub\n"
+    "  culprit\n"
+    "  says I was home alone all night\n"
+    "  says I don't know what you're implying!\n"
+    "  says *nervously checks watch*\n"
+    "  tell You notice her hands shaking...\n"
+    "  press ballistics Your prints are all over the gun that killed him.\n"
+    "    says That gun was stolen from my office weeks ago!\n"
+    "    press witness Somebody heard you arguing with him at ten.\n"
+    "      says Fine, we argued. Johnny wanted more money. He always wanted more.\n"
+    "      tell She's no longer looking you in the eye.\n"
+    "    end\n"
+    "  end\n"
+    "  press tox_report The doc says you asked her about sedatives.\n"
+    "    says A girl's got to sleep, detective.\n"
+    "  end\n"
+    "suspect Big Louie Scaletta\n"
+    "  alias Louie\n"
+    "  role dock worker\n"
+    "  at Docks\n"
+    "  says I was unloading cargo, ask my crew\n"
+    "  says The victim? Never liked him, but I didn't kill him\n"
+    "  says Tony's been desperate for money...\n"
+    "suspect Mickey O'Shea\n"
+    "  alias Mickey\n"
+    "  role bartender\n"
+    "  at Police Station\n"
+    "  says I was tending bar all night\n"
+    "  says That gun ain't mine, copper!\n"
+    "  says Victoria's been dealing under the table...\n"
+    "suspect Dr. Eleanor Whitmore\n"
+    "  alias Eleanor\n"
+    "  role medical examiner\n"
+    "  at City Morgue\n"
+    "  says Time of death was approximately 11:15pm\n"
+    "  says The wound shows signs of a close-range shot\n"
+    "  says Victoria came by earlier asking about sedatives...\n"
+    "  note Note: Check tox_report.txt for details on sedatives\n"
+    "  press tox_report The tox report shows barbiturates. Enough to knock him out?\n"
+    "    says Enough that he couldn't have fought back.\n"
+    "  end\n"
+    "suspect Sal 'The Tailor' Russo\n"
+    "  alias Sal\n"
+    "  role hotel owner\n"
+    "  at Roosevelt Hotel\n"
+    "  says Johnny owed me rent for three months!\n"
+    "  says Room #47 was his usual spot with... certain ladies\n"
+    "  says I heard Victoria threatened him last week\n"
+    "  note Note: Examine hotel_key.txt about Room #47\n"
+    "  press hotel_key He had the key to Room #47 on him. Who was he meeting?\n"
+    "    says A redhead. Came in the back way, wore a lot of perfume. Could've been Vixen.\n"
+    "  end\n"
+    "\n"
+    "evidence ledger\n"
+    "  file ledger.txt\n"
+    "  content Last entry: Owes $5000 to Vixen\n"
+    "  note Large payment to 'Vixen' noted\n"
+    "evidence ballistics\n"
+    "  file ballistics.txt\n"
+    "  content Fingerprint match: V. LaRue\n"
+    "  note Gun registered to Victoria LaRue\n"
+    "evidence witness\n"
+    "  file witness.txt\n"
+    "  content 10pm: Heard arguing near dumpsters\\n11:30pm: Gunshot heard\n"
+    "  note Timeline matches Victoria's alibi gap\n"
+    "evidence forensics\n"
+    "  file forensics.txt\n"
+    "  content Victim had traces of lipstick on collar (shade matches Victoria)\n"
+    "  note Victoria was seen with victim before murder\n"
+    "evidence hotel_key\n"
+    "  file hotel_key.txt\n"
+    "  content Hotel Key #47 found in victim's pocket (Roosevelt Hotel)\n"
+    "  note Connects victim to Roosevelt Hotel\n"
+    "evidence tox_report\n"
+    "  file tox_report.txt\n"
+    "  content Toxicology: High levels of barbiturates in victim's system\n"
+    "  note Matches Victoria's access to sedatives\n"
+    "\n"
+    "step You find a .38 snubnose under the victim's body\n"
+    "  reveals ledger\n"
+    "step The victim's ledger (type 'examine ledger') shows suspicious entries\n"
+    "  reveals ballistics\n"
+    "step A ballistics report (type 'examine ballistics') contains damning evidence\n"
+    "  reveals witness\n"
+    "step The witness statement (type 'examine witness') tells a revealing story\n"
+    "  reveals forensics\n"
+    "step You discover hotel key (type 'examine hotel_key') in the victim's coat pocket\n"
+    "  reveals hotel_key\n"
+    "step The toxicology report (type 'examine tox_report') reveals critical details\n"
+    "  reveals tox_report\n";
+
+unsigned int checksum32(const void *data, size_t size) {
+    const unsigned char *p = data;
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+unsigned int intern_string(StringTable *table, const char *text) {
+    size_t len = strlen(text) + 1;
+    if (table->slot_count == 0 || (table->count + 1) * 2 > table->slot_count) {
+        size_t slot_count = table->slot_count ? table->slot_count * 2 : 256;
+        unsigned int *slots = calloc(slot_count, sizeof(unsigned int));
+        for (size_t i = 0; i < table->slot_count; i++) {
+            if (table->slots[i] == 0) continue;
+            size_t j = checksum32(table->pool + table->slots[i] - 1, strlen(table->pool + table->slots[i] - 1)) & (slot_count - 1);
+            while (slots[j]) j = (j + 1) & (slot_count - 1);
+            slots[j] = table->slots[i];
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->slot_count = slot_count;
+    }
+
+    size_t j = checksum32(text, len - 1) & (table->slot_count - 1);
+    while (table->slots[j]) {
+        if (strcmp(table->pool + table->slots[j] - 1, text) == 0) {
+            return table->slots[j];
+        }
+        j = (j + 1) & (table->slot_count - 1);
+    }
+
+    if (table->used + len > table->cap) {
+        table->cap = table->cap ? table->cap * 2 : 4096;
+        while (table->used + len > table->cap) table->cap *= 2;
+        table->pool = realloc(table->pool, table->cap);
+    }
+    memcpy(table->pool + table->used, text, len);
+    table->slots[j] = table->used + 1;
+    table->used += len;
+    table->count++;
+    return table->slots[j];
+}
+
+static void *grow_table(void *table, unsigned int count, size_t size) {
+    if ((count & (count - 1)) == 0) {
+        table = realloc(table, (count ? count * 2 : 1) * size);
+    }
+    memset((char *)table + count * size, 0, size);
+    return table;
+}
+
+static void unescape_value(char *value) {
+    char *out = value;
+    for (char *p = value; *p; p++) {
+        if (*p == '\\' && p[1] == 'n') {
+            *out++ = '\n';
+            p++;
+        } else if (*p == '\\' && p[1] == '\\') {
+            *out++ = '\\';
+            p++;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+unsigned char *compile_case(const char *text, size_t *pack_size, char *error, size_t error_size) {
+    StringTable strings = {0};
+    PackHeader header = {0};
+    PackLocation *locations = NULL;
+    PackSuspect *suspects = NULL;
+    PackStep *steps = NULL;
+    PackEvidence *evidence = NULL;
+    PackLine *lines = NULL;
+    unsigned int *line_presses = NULL;
+    unsigned int *suspect_at = NULL;
+    unsigned int *step_reveals = NULL;
+    unsigned char *pack = NULL;
+    char intro[4096] = "";
+    char *copy = strdup(text);
+    char *save;
+    int line_no = 0;
+    int culprits = 0;
+    unsigned int depth = 0;
+    enum { IN_CASE, IN_LOCATION, IN_SUSPECT, IN_EVIDENCE, IN_STEP } current = IN_CASE;
+
+    error[0] = '\0';
+    intern_string(&strings, "");
+    for (char *line = strtok_r(copy, "\n", &save); line && !error[0]; line = strtok_r(NULL, "\n", &save)) {
+        line_no++;
+        line[strcspn(line, "\r")] = '\0';
+        while (*line == ' ' || *line == '\t') line++;
+        if (*line == '\0' || *line == '#') continue;
+
+        char *value = line + strcspn(line, " \t");
+        if (*value) *value++ = '\0';
+        while (*value == ' ' || *value == '\t') value++;
+        unescape_value(value);
+        unsigned int press = 0;
+        if (current == IN_SUSPECT && strcmp(line, "press") == 0) {
+            char *question = value + strcspn(value, " \t");
+            if (*question) *question++ = '\0';
+            while (*question == ' ' || *question == '\t') question++;
+            if (*value == '\0' || *question == '\0') {
+                snprintf(error, error_size, "line %d: press needs evidence and a question", line_no);
+            }
+            press = intern_string(&strings, value);
+            value = question;
+        }
+        unsigned int id = intern_string(&strings, value);
+
+        if (depth > 0 && (strcmp(line, "location") == 0 || strcmp(line, "suspect") == 0 ||
+                          strcmp(line, "evidence") == 0 || strcmp(line, "step") == 0)) {
+            snprintf(error, error_size, "line %d: missing 'end' for press", line_no);
+        } else if (strcmp(line, "case") == 0) {
+            header.name = id;
+        } else if (strcmp(line, "title") == 0) {
+            header.title = id;
+        } else if (strcmp(line, "intro") == 0) {
+            snprintf(intro + strlen(intro), sizeof(intro) - strlen(intro), "%s%s", intro[0] ? "\n" : "", value);
+        } else if (strcmp(line, "victim") == 0) {
+            header.victim = id;
+        } else if (strcmp(line, "weapon") == 0) {
+            header.weapon = id;
+        } else if (strcmp(line, "motive") == 0) {
+            header.motive = id;
+        } else if (strcmp(line, "location") == 0) {
+            locations = grow_table(locations, header.location_count, sizeof(PackLocation));
+            locations[header.location_count++].name = id;
+            current = IN_LOCATION;
+        } else if (strcmp(line, "suspect") == 0) {
+            suspects = grow_table(suspects, header.suspect_count, sizeof(PackSuspect));
+            suspect_at = grow_table(suspect_at, header.suspect_count, sizeof(unsigned int));
+            suspects[header.suspect_count].name = id;
+            suspects[header.suspect_count++].lines = header.line_count;
+            current = IN_SUSPECT;
+        } else if (strcmp(line, "evidence") == 0) {
+            evidence = grow_table(evidence, header.evidence_count, sizeof(PackEvidence));
+            evidence[header.evidence_count++].name = id;
+            current = IN_EVIDENCE;
+        } else if (strcmp(line, "step") == 0) {
+            steps = grow_table(steps, header.step_count, sizeof(PackStep));
+            step_reveals = grow_table(step_reveals, header.step_count, sizeof(unsigned int));
+            steps[header.step_count++].text = id;
+            current = IN_STEP;
+        } else if (current == IN_LOCATION && strcmp(line, "detail") == 0) {
+            locations[header.location_count - 1].detail = id;
+        } else if (current == IN_SUSPECT && strcmp(line, "alias") == 0) {
+            suspects[header.suspect_count - 1].alias = id;
+        } else if (current == IN_SUSPECT && strcmp(line, "role") == 0) {
+            suspects[header.suspect_count - 1].role = id;
+        } else if (current == IN_SUSPECT && strcmp(line, "at") == 0) {
+            suspect_at[header.suspect_count - 1] = id;
+        } else if (current == IN_SUSPECT && strcmp(line, "culprit") == 0) {
+            header.culprit = header.suspect_count - 1;
+            culprits++;
+        } else if (current == IN_SUSPECT && (strcmp(line, "says") == 0 || strcmp(line, "tell") == 0 ||
+                                             strcmp(line, "note") == 0 || strcmp(line, "press") == 0)) {
+            if (depth >= DIALOGUE_MAX_DEPTH) {
+                snprintf(error, error_size, "line %d: press blocks nest at most %d deep", line_no, DIALOGUE_MAX_DEPTH - 1);
+            }
+            lines = grow_table(lines, header.line_count, sizeof(PackLine));
+            line_presses = grow_table(line_presses, header.line_count, sizeof(unsigned int));
+            PackLine *entry = &lines[header.line_count];
+            entry->kind = line[0] == 's' ? DIALOGUE_SAYS : line[0] == 't' ? DIALOGUE_TELL :
+                          line[0] == 'n' ? DIALOGUE_NOTE : DIALOGUE_PRESS;
+            entry->depth = depth;
+            entry->text = id;
+            entry->evidence = CASE_NONE;
+            line_presses[header.line_count++] = press;
+            suspects[header.suspect_count - 1].line_count++;
+            if (press) depth++;
+        } else if (current == IN_SUSPECT && depth > 0 && strcmp(line, "end") == 0) {
+            depth--;
+        } else if (current == IN_EVIDENCE && strcmp(line, "file") == 0) {
+            if (strchr(value, '/') || value[0] == '.' || value[0] == '\0') {
+                snprintf(error, error_size, "line %d: evidence file must be a plain file name", line_no);
+            }
+            evidence[header.evidence_count - 1].file = id;
+        } else if (current == IN_EVIDENCE && strcmp(line, "content") == 0) {
+            evidence[header.evidence_count - 1].content = id;
+        } else if (current == IN_EVIDENCE && strcmp(line, "note") == 0) {
+            evidence[header.evidence_count - 1].note = id;
+        } else if (current == IN_STEP && strcmp(line, "reveals") == 0) {
+            step_reveals[header.step_count - 1] = id;
+        } else {
+            snprintf(error, error_size, "line %d: unexpected '%s'", line_no, line);
+        }
+    }
+    if (depth > 0 && !error[0]) {
+        snprintf(error, error_size, "missing 'end' for press");
+    }
+    header.intro = intern_string(&strings, intro);
+
+    for (unsigned int i = 0; i < header.suspect_count && !error[0]; i++) {
+        suspects[i].location = CASE_NONE;
+        for (unsigned int j = 0; j < header.location_count; j++) {
+            if (locations[j].name == suspect_at[i]) suspects[i].location = j;
+        }
+        if (suspects[i].location == CASE_NONE) {
+            snprintf(error, error_size, "suspect '%s' has no known location", strings.pool + suspects[i].name - 1);
+        }
+    }
+    for (unsigned int i = 0; i < header.step_count && !error[0]; i++) {
+        steps[i].reveals = CASE_NONE;
+        for (unsigned int j = 0; j < header.evidence_count; j++) {
+            if (evidence[j].name == step_reveals[i]) steps[i].reveals = j;
+        }
+        if (step_reveals[i] > 1 && steps[i].reveals == CASE_NONE) {
+            snprintf(error, error_size, "step %u reveals unknown evidence '%s'", i + 1, strings.pool + step_reveals[i] - 1);
+        }
+    }
+    for (unsigned int i = 0; i < header.line_count && !error[0]; i++) {
+        if (lines[i].kind != DIALOGUE_PRESS) continue;
+        for (unsigned int j = 0; j < header.evidence_count; j++) {
+            if (evidence[j].name == line_presses[i]) lines[i].evidence = j;
+        }
+        if (lines[i].evidence == CASE_NONE) {
+            snprintf(error, error_size, "press on unknown evidence '%s'", strings.pool + line_presses[i] - 1);
+        }
+    }
+    for (unsigned int i = 0; i < header.evidence_count && !error[0]; i++) {
+        if (evidence[i].file <= 1) {
+            snprintf(error, error_size, "evidence '%s' has no file", strings.pool + evidence[i].name - 1);
+        }
+    }
+    if (!error[0]) {
+        if (header.location_count == 0 || header.suspect_count == 0 || header.step_count == 0) {
+            snprintf(error, error_size, "a case needs at least one location, suspect and step");
+        } else if (culprits != 1) {
+            snprintf(error, error_size, "a case needs exactly one culprit, found %d", culprits);
+        } else if (header.location_count > CASE_MAX_LOCATIONS || header.suspect_count > CASE_MAX_SUSPECTS ||
+                   header.step_count > CASE_MAX_STEPS) {
+            snprintf(error, error_size, "a case may have at most %d locations, %d suspects and %d steps",
+                     CASE_MAX_LOCATIONS, CASE_MAX_SUSPECTS, CASE_MAX_STEPS);
+        }
+    }
+
+    if (!error[0]) {
+        size_t offset = sizeof(PackHeader);
+        header.locations = offset;
+        offset += header.location_count * sizeof(PackLocation);
+        header.suspects = offset;
+        offset += header.suspect_count * sizeof(PackSuspect);
+        header.steps = offset;
+        offset += header.step_count * sizeof(PackStep);
+        header.evidence = offset;
+        offset += header.evidence_count * sizeof(PackEvidence);
+        header.lines = offset;
+        offset += header.line_count * sizeof(PackLine);
+        unsigned int base = offset - 1;
+
+#define PACK_STRING(id) ((id) > 1 ? (id) + base : 0)
+        header.magic = PACK_MAGIC;
+        header.version = PACK_VERSION;
+        header.size = offset + strings.used;
+        header.name = PACK_STRING(header.name);
+        header.title = PACK_STRING(header.title);
+        header.intro = PACK_STRING(header.intro);
+        header.victim = PACK_STRING(header.victim);
+        header.weapon = PACK_STRING(header.weapon);
+        header.motive = PACK_STRING(header.motive);
+        for (unsigned int i = 0; i < header.location_count; i++) {
+            locations[i].name = PACK_STRING(locations[i].name);
+            locations[i].detail = PACK_STRING(locations[i].detail);
+        }
+        for (unsigned int i = 0; i < header.suspect_count; i++) {
+            suspects[i].name = PACK_STRING(suspects[i].name);
+            suspects[i].alias = PACK_STRING(suspects[i].alias);
+            suspects[i].role = PACK_STRING(suspects[i].role);
+        }
+        for (unsigned int i = 0; i < header.step_count; i++) {
+            steps[i].text = PACK_STRING(steps[i].text);
+        }
+        for (unsigned int i = 0; i < header.evidence_count; i++) {
+            evidence[i].name = PACK_STRING(evidence[i].name);
+            evidence[i].file = PACK_STRING(evidence[i].file);
+            evidence[i].content = PACK_STRING(evidence[i].content);
+            evidence[i].note = PACK_STRING(evidence[i].note);
+        }
+        for (unsigned int i = 0; i < header.line_count; i++) {
+            lines[i].text = PACK_STRING(lines[i].text);
+        }
+#undef PACK_STRING
+
+        pack = calloc(1, header.size);
+        memcpy(pack + header.locations, locations, header.location_count * sizeof(PackLocation));
+        memcpy(pack + header.suspects, suspects, header.suspect_count * sizeof(PackSuspect));
+        memcpy(pack + header.steps, steps, header.step_count * sizeof(PackStep));
+        memcpy(pack + header.evidence, evidence, header.evidence_count * sizeof(PackEvidence));
+        memcpy(pack + header.lines, lines, header.line_count * sizeof(PackLine));
+        memcpy(pack + offset, strings.pool, strings.used);
+        header.checksum = checksum32(pack + sizeof(PackHeader), header.size - sizeof(PackHeader));
+        memcpy(pack, &header, sizeof(header));
+        *pack_size = header.size;
+    }
+
+    free(copy);
+    free(strings.pool);
+    free(strings.slots);
+    free(locations);
+    free(suspects);
+    free(steps);
+    free(evidence);
+    free(lines);
+    free(line_presses);
+    free(suspect_at);
+    free(step_reveals);
+    return pack;
+}
+
+int compile_case_file(const char *source, const char *target) {
+    char out_path[512], error[256];
+    FILE *in = fopen(source, "r");
+    if (in == NULL) {
+        perror(source);
+        return 1;
+    }
+    char *text = NULL;
+    size_t len = 0;
+    FILE *buf = open_memstream(&text, &len);
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        fwrite(chunk, 1, n, buf);
+    }
+    fclose(buf);
+    fclose(in);
+
+    if (target == NULL) {
+        snprintf(out_path, sizeof(out_path), "%s", source);
+        char *dot = strrchr(out_path, '.');
+        if (dot && strchr(dot, '/') == NULL) *dot = '\0';
+        strncat(out_path, ".pack", sizeof(out_path) - strlen(out_path) - 1);
+        target = out_path;
+    }
+
+    size_t size;
+    unsigned char *pack = compile_case(text, &size, error, sizeof(error));
+    free(text);
+    if (pack == NULL) {
+        fprintf(stderr, "%s: %s\n", source, error);
+        return 1;
+    }
+
+    int fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || write(fd, pack, size) != (ssize_t)size) {
+        perror(target);
+        if (fd != -1) close(fd);
+        free(pack);
+        return 1;
+    }
+    close(fd);
+
+    const PackHeader *header = (const PackHeader *)pack;
+    printf("%s: %u locations, %u suspects, %u evidence, %u steps, %zu bytes\n", target,
+           header->location_count, header->suspect_count, header->evidence_count, header->step_count, size);
+    free(pack);
+    return 0;
+}
+
+static int pack_table_ok(const PackHeader *header, unsigned int offset, unsigned int count, size_t size) {
+    return offset >= sizeof(PackHeader) && offset % 4 == 0 && offset <= header->size &&
+           count <= (header->size - offset) / size;
+}
+
+static int pack_string_ok(const unsigned char *data, size_t size, unsigned int offset) {
+    return offset == 0 || (offset >= sizeof(PackHeader) && offset < size && memchr(data + offset, '\0', size - offset) != NULL);
+}
+
+int use_pack(const unsigned char *data, size_t size, const char *source) {
+    const PackHeader *header = (const PackHeader *)data;
+    const char *problem = NULL;
+
+    if (size < sizeof(PackHeader) || header->magic != PACK_MAGIC) {
+        problem = "not a case pack";
+    } else if (header->version != PACK_VERSION) {
+        problem = "built for a different version";
+    } else if (header->size != size || data[size - 1] != '\0') {
+        problem = "truncated";
+    } else if (header->checksum != checksum32(data + sizeof(PackHeader), size - sizeof(PackHeader))) {
+        problem = "checksum mismatch";
+    } else if (!pack_table_ok(header, header->locations, header->location_count, sizeof(PackLocation)) ||
+               !pack_table_ok(header, header->suspects, header->suspect_count, sizeof(PackSuspect)) ||
+               !pack_table_ok(header, header->steps, header->step_count, sizeof(PackStep)) ||
+               !pack_table_ok(header, header->evidence, header->evidence_count, sizeof(PackEvidence)) ||
+               !pack_table_ok(header, header->lines, header->line_count, sizeof(PackLine)) ||
+               header->location_count == 0 || header->location_count > CASE_MAX_LOCATIONS ||
+               header->suspect_count == 0 || header->suspect_count > CASE_MAX_SUSPECTS ||
+               header->step_count == 0 || header->step_count > CASE_MAX_STEPS ||
+               header->culprit >= header->suspect_count) {
+        problem = "corrupt tables";
+    } else if (!pack_string_ok(data, size, header->name) || !pack_string_ok(data, size, header->title) ||
+               !pack_string_ok(data, size, header->intro) || !pack_string_ok(data, size, header->victim) ||
+               !pack_string_ok(data, size, header->weapon) || !pack_string_ok(data, size, header->motive)) {
+        problem = "corrupt strings";
+    }
+    if (problem) {
+        fprintf(stderr, "%s: %s\n", source, problem);
+        return -1;
+    }
+
+    const PackLocation *locations = (const PackLocation *)(data + header->locations);
+    const PackSuspect *suspects = (const PackSuspect *)(data + header->suspects);
+    const PackStep *steps = (const PackStep *)(data + header->steps);
+    const PackEvidence *evidence = (const PackEvidence *)(data + header->evidence);
+    const PackLine *lines = (const PackLine *)(data + header->lines);
+    for (unsigned int i = 0; problem == NULL && i < header->location_count; i++) {
+        if (!pack_string_ok(data, size, locations[i].name) || !pack_string_ok(data, size, locations[i].detail)) {
+            problem = "corrupt location table";
+        }
+    }
+    for (unsigned int i = 0; problem == NULL && i < header->evidence_count; i++) {
+        if (!pack_string_ok(data, size, evidence[i].name) || !pack_string_ok(data, size, evidence[i].file) ||
+            !pack_string_ok(data, size, evidence[i].content) || !pack_string_ok(data, size, evidence[i].note)) {
+            problem = "corrupt evidence table";
+        }
+    }
+    for (unsigned int i = 0; problem == NULL && i < header->suspect_count; i++) {
+        if (suspects[i].location >= header->location_count || suspects[i].lines > header->line_count ||
+            suspects[i].line_count > header->line_count - suspects[i].lines ||
+            !pack_string_ok(data, size, suspects[i].name) || !pack_string_ok(data, size, suspects[i].alias) ||
+            !pack_string_ok(data, size, suspects[i].role)) {
+            problem = "corrupt suspect table";
+        }
+        unsigned int open = 0;
+        for (unsigned int j = 0; problem == NULL && j < suspects[i].line_count; j++) {
+            const PackLine *line = &lines[suspects[i].lines + j];
+            if (line->kind > DIALOGUE_PRESS || line->depth > open || line->depth >= DIALOGUE_MAX_DEPTH ||
+                (line->kind == DIALOGUE_PRESS && line->evidence >= header->evidence_count) ||
+                !pack_string_ok(data, size, line->text)) {
+                problem = "corrupt dialogue table";
+            }
+            open = line->depth + (line->kind == DIALOGUE_PRESS);
+        }
+    }
+    for (unsigned int i = 0; problem == NULL && i < header->step_count; i++) {
+        if ((steps[i].reveals != CASE_NONE && steps[i].reveals >= header->evidence_count) ||
+            !pack_string_ok(data, size, steps[i].text)) {
+            problem = "corrupt step table";
+        }
+    }
+    if (problem) {
+        fprintf(stderr, "%s: %s\n", source, problem);
+        return -1;
+    }
+
+    pack = header;
+    pack_locations = locations;
+    pack_suspects = suspects;
+    pack_steps = steps;
+    pack_evidence = evidence;
+    pack_lines = lines;
+    dialogue_reset();
+    return 0;
+}
+
+int load_case(const char *name) {
+    char path[512], error[256];
+    if (name == NULL) {
+        size_t size;
+        unsigned char *data = compile_case(default_case_text, &size, error, sizeof(error));
+        if (data == NULL) {
+            fprintf(stderr, "built-in case: %s\n", error);
+            return -1;
+        }
+        return use_pack(data, size, "built-in case");
+    }
+
+    if (strchr(name, '/') || strstr(name, ".pack")) {
+        snprintf(path, sizeof(path), "%s", name);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s.pack", CASE_DIR, name);
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (st.st_size == 0 || data == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map case pack\n", path);
+        return -1;
+    }
+    return use_pack(data, st.st_size, path);
+}
+
+const char *pack_string(unsigned int offset) {
+    return offset ? (const char *)pack + offset : "";
+}
+
+static int merge_entity(int current, int entity) {
+    if (current == RESOLVE_NONE || current == entity) return entity;
+    return RESOLVE_AMBIGUOUS;
+}
+
+static int trie_child(Trie *trie, int node, unsigned char ch) {
+    int prev = 0;
+    int child = trie->nodes[node].child;
+    while (child && trie->nodes[child].ch < ch) {
+        prev = child;
+        child = trie->nodes[child].sibling;
+    }
+    if (child && trie->nodes[child].ch == ch) {
+        return child;
+    }
+
+    if (trie->count == trie->cap) {
+        trie->cap *= 2;
+        trie->nodes = realloc(trie->nodes, trie->cap * sizeof(TrieNode));
+    }
+    int index = trie->count++;
+    TrieNode *fresh = &trie->nodes[index];
+    memset(fresh, 0, sizeof(*fresh));
+    fresh->ch = ch;
+    fresh->sibling = child;
+    fresh->exact = RESOLVE_NONE;
+    fresh->subtree = RESOLVE_NONE;
+    if (prev) {
+        trie->nodes[prev].sibling = index;
+    } else {
+        trie->nodes[node].child = index;
+    }
+    return index;
+}
+
+static void trie_insert(Trie *trie, const char *key, size_t len, int entity) {
+    int node = 0;
+    if (len == 0) return;
+    for (size_t i = 0; i < len; i++) {
+        if (key[i] == '\'' || key[i] == '"') continue;
+        node = trie_child(trie, node, tolower((unsigned char)key[i]));
+        trie->nodes[node].subtree = merge_entity(trie->nodes[node].subtree, entity);
+    }
+
+    TrieNode *end = &trie->nodes[node];
+    end->exact = merge_entity(end->exact, entity);
+    for (int e = end->entries; e; e = trie->entries[e].next) {
+        if (trie->entries[e].entity == entity) return;
+    }
+    if (trie->entry_count == trie->entry_cap) {
+        trie->entry_cap *= 2;
+        trie->entries = realloc(trie->entries, trie->entry_cap * sizeof(TrieEntry));
+    }
+    trie->entries[trie->entry_count].entity = entity;
+    trie->entries[trie->entry_count].next = end->entries;
+    end->entries = trie->entry_count++;
+}
+
+void trie_add_name(Trie *trie, const char *name, int entity) {
+    if (name == NULL) return;
+    if (trie->count == 0) {
+        trie->cap = 256;
+        trie->nodes = calloc(trie->cap, sizeof(TrieNode));
+        trie->count = 1;
+        trie->entry_cap = 256;
+        trie->entries = calloc(trie->entry_cap, sizeof(TrieEntry));
+        trie->entry_count = 1;
+    }
+
+    trie_insert(trie, name, strlen(name), entity);
+    for (const char *p = name; *p; ) {
+        p += strspn(p, " _'\"");
+        size_t len = strcspn(p, " _'\"");
+        trie_insert(trie, p, len, entity);
+        p += len;
+    }
+}
+
+static int trie_find(const Trie *trie, const char *query) {
+    int node = 0;
+    if (trie->count == 0) return -1;
+    for (const unsigned char *p = (const unsigned char *)query; *p; p++) {
+        if (*p == '\'' || *p == '"') continue;
+        unsigned char ch = tolower(*p);
+        int child = trie->nodes[node].child;
+        while (child && trie->nodes[child].ch < ch) {
+            child = trie->nodes[child].sibling;
+        }
+        if (child == 0 || trie->nodes[child].ch != ch) {
+            return -1;
+        }
+        node = child;
+    }
+    return node;
+}
+
+int trie_lookup(const Trie *trie, const char *query) {
+    int node = trie_find(trie, query);
+    if (node <= 0) return RESOLVE_NONE;
+    if (trie->nodes[node].exact >= 0) return trie->nodes[node].exact;
+    return trie->nodes[node].subtree;
+}
+
+static void trie_collect(const Trie *trie, int node, int *found, int *count, int max) {
+    const TrieNode *n = &trie->nodes[node];
+    for (int e = n->entries; e && *count < max; e = trie->entries[e].next) {
+        int seen = 0;
+        for (int i = 0; i < *count; i++) {
+            if (found[i] == trie->entries[e].entity) seen = 1;
+        }
+        if (!seen) found[(*count)++] = trie->entries[e].entity;
+    }
+    for (int child = n->child; child && *count < max; child = trie->nodes[child].sibling) {
+        trie_collect(trie, child, found, count, max);
+    }
+}
+
+int resolve_name(const Trie *trie, const char *query, const char *(*name_of)(unsigned int)) {
+    int entity = trie_lookup(trie, query);
+    if (entity != RESOLVE_AMBIGUOUS) return entity;
+
+    int found[RESOLVE_SHOWN + 1];
+    int count = 0;
+    trie_collect(trie, trie_find(trie, query), found, &count, RESOLVE_SHOWN + 1);
+    sh_printf("'%s' could mean ", query);
+    for (int i = 0; i < count && i < RESOLVE_SHOWN; i++) {
+        sh_printf("%s%s", i == 0 ? "" : (i == count - 1 ? " or " : ", "), name_of(found[i]));
+    }
+    sh_printf("%s. Be more specific.\n", count > RESOLVE_SHOWN ? ", ..." : "");
+    return RESOLVE_AMBIGUOUS;
+}
+
+const char *suspect_name(unsigned int i) {
+    return pack_string(pack_suspects[i].name);
+}
+
+const char *location_name(unsigned int i) {
+    return pack_string(pack_locations[i].name);
+}
+
+const char *evidence_name(unsigned int i) {
+    return pack_string(pack_evidence[i].name);
+}
+
+static int completion_find(const Completer *c, const char *text) {
+    int node = trie_find(&c->trie, text);
+    if (node <= 0) return -1;
+    for (int e = c->trie.nodes[node].entries; e; e = c->trie.entries[e].next) {
+        int id = c->trie.entries[e].entity;
+        if (strcmp(c->words[id].text, text) == 0) return id;
+    }
+    return -1;
+}
+
+void complete_add(Completer *c, const char *text, int kind) {
+    if (text == NULL || *text == '\0') return;
+    pthread_mutex_lock(&completion_lock);
+    int id = completion_find(c, text);
+    if (id < 0) {
+        if (c->count == c->cap) {
+            c->cap = c->cap ? c->cap * 2 : 64;
+            c->words = realloc(c->words, c->cap * sizeof(CompletionWord));
+        }
+        id = c->count++;
+        c->words[id].text = strdup(text);
+        c->words[id].kinds = 0;
+        trie_add_name(&c->trie, text, id);
+    }
+    c->words[id].kinds |= kind;
+    pthread_mutex_unlock(&completion_lock);
+}
+
+void complete_remove(Completer *c, const char *text, int kind) {
+    pthread_mutex_lock(&completion_lock);
+    int id = completion_find(c, text);
+    if (id >= 0) c->words[id].kinds &= ~kind;
+    pthread_mutex_unlock(&completion_lock);
+}
+
+static void completion_collect(const Completer *c, int node, int kinds, int *found, int *count, int max) {
+    const TrieNode *n = &c->trie.nodes[node];
+    for (int e = n->entries; e && *count < max; e = c->trie.entries[e].next) {
+        int id = c->trie.entries[e].entity;
+        int seen = !(c->words[id].kinds & kinds);
+        for (int i = 0; i < *count && !seen; i++) {
+            seen = found[i] == id;
+        }
+        if (!seen) found[(*count)++] = id;
+    }
+    for (int child = n->child; child && *count < max; child = c->trie.nodes[child].sibling) {
+        completion_collect(c, child, kinds, found, count, max);
+    }
+}
+
+int complete_candidates(Completer *c, const char *prefix, int kinds, char **found, int max) {
+    int ids[COMPLETE_SHOWN];
+    int count = 0;
+    if (max > COMPLETE_SHOWN) max = COMPLETE_SHOWN;
+    pthread_mutex_lock(&completion_lock);
+    int node = trie_find(&c->trie, prefix);
+    if (node >= 0) {
+        completion_collect(c, node, kinds, ids, &count, max);
+    }
+    for (int i = 0; i < count; i++) {
+        found[i] = strdup(c->words[ids[i]].text);
+    }
+    pthread_mutex_unlock(&completion_lock);
+    return count;
+}
+
+void build_resolvers() {
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        trie_add_name(&suspect_names, pack_string(pack_suspects[i].name), i);
+        trie_add_name(&suspect_names, pack_string(pack_suspects[i].alias), i);
+        complete_add(&completer, pack_string(pack_suspects[i].name), COMPLETE_SUSPECT);
+        complete_add(&completer, pack_string(pack_suspects[i].alias), COMPLETE_SUSPECT);
+    }
+    for (unsigned int i = 0; i < pack->location_count; i++) {
+        trie_add_name(&location_names, pack_string(pack_locations[i].name), i);
+        complete_add(&completer, pack_string(pack_locations[i].name), COMPLETE_LOCATION);
+    }
+    for (unsigned int i = 0; i < pack->evidence_count; i++) {
+        trie_add_name(&evidence_names, pack_string(pack_evidence[i].name), i);
+        trie_add_name(&evidence_names, pack_string(pack_evidence[i].file), i);
+        complete_add(&completer, pack_string(pack_evidence[i].name), COMPLETE_EVIDENCE);
+        complete_add(&completer, pack_string(pack_evidence[i].file), COMPLETE_EVIDENCE);
+    }
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        const PackSuspect *who = &pack_suspects[i];
+        for (unsigned int j = 0; j < who->line_count; j++) {
+            const PackLine *line = &pack_lines[who->lines + j];
+            if (line->depth == 0 && (line->kind == DIALOGUE_SAYS || line->kind == DIALOGUE_TELL)) {
+                search_add(&dialogue_index, suspect_name(i), NULL, pack_string(line->text), i);
+            }
+        }
+    }
+}
+
+/* Returns the arguments joined by single spaces in a malloc'd string. */
+char *join_args(char **args) {
+    size_t size = 1;
+    for (int i = 0; args[i]; i++) size += strlen(args[i]) + 1;
+    char *buf = malloc(size);
+    char *end = buf;
+    *end = '\0';
+    for (int i = 0; args[i]; i++) {
+        if (i > 0) *end++ = ' ';
+        end = stpcpy(end, args[i]);
+    }
+    return buf;
+}
+
+void init_game() {
+    memset(&session->game, 0, sizeof(session->game));
+}
+
+void create_case_files() {
+    if (mkdir(session->case_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(sh_err, "mkdir %s: %s\n", session->case_dir, strerror(errno));
+    }
+    evidence_open(&session->store, session->case_dir);
+    if (session->remote) return;
+
+    DIR *d = opendir(session->case_dir);
+    if (d == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] != '.') complete_add(&completer, entry->d_name, COMPLETE_FILE);
+    }
+    closedir(d);
+}
+
+void init_tool_modes() {
+    char *env = getenv("NOIRE_EXTERNAL");
+    if (env == NULL) return;
+
+    char list[256];
+    snprintf(list, sizeof(list), "%s", env);
+    for (char *name = strtok(list, ", "); name != NULL; name = strtok(NULL, ", ")) {
+        for (int i = 0; tool_modes[i].name != NULL; i++) {
+            if (strcmp(tool_modes[i].name, name) == 0 || strcmp(name, "all") == 0) {
+                tool_modes[i].external = 1;
+            }
+        }
+    }
+}
+
+int tool_is_external(const char *name) {
+    for (int i = 0; tool_modes[i].name != NULL; i++) {
+        if (strcmp(tool_modes[i].name, name) == 0) {
+            return tool_modes[i].external;
+        }
+    }
+    return 0;
+}
+
+void handle_tool(char **args) {
+    if (args[1] == NULL) {
+        for (int i = 0; tool_modes[i].name != NULL; i++) {
+            sh_printf("  %-8s %s\n", tool_modes[i].name, tool_modes[i].external ? "external" : "native");
+        }
+        return;
+    }
+    if (args[2] == NULL || (strcmp(args[2], "native") != 0 && strcmp(args[2], "external") != 0)) {
+        sh_printf("Usage: tool [name] [native|external]\n");
+        return;
+    }
+    for (int i = 0; tool_modes[i].name != NULL; i++) {
+        if (strcmp(tool_modes[i].name, args[1]) == 0 || strcmp(args[1], "all") == 0) {
+            tool_modes[i].external = strcmp(args[2], "external") == 0;
+            if (strcmp(args[1], "all") != 0) return;
+        }
+    }
+    if (strcmp(args[1], "all") != 0) {
+        sh_printf("No tool by that name. Try: cat, rev, ls, du, date, examine\n");
+    }
+}
+
+static int sh_color() {
+    if (screen_color >= 0) return screen_color;
+    return session->use_color && sh_out == session->out;
+}
+
+void sh_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(sh_out, fmt, ap);
+    va_end(ap);
+}
+
+void sh_styled(Style style, const char *fmt, ...) {
+    int color = sh_color();
+    va_list ap;
+    va_start(ap, fmt);
+    if (color) fputs(style_codes[style], sh_out);
+    vfprintf(sh_out, fmt, ap);
+    if (color) fputs("\033[0m", sh_out);
+    va_end(ap);
+}
+
+static int render_append(RenderBuffer *r, const char *data, size_t len, int copy) {
+    if (len == 0) return 0;
+    if (copy && r->used + len > r->cap) {
+        size_t cap = r->cap ? r->cap : 4096;
+        while (cap < r->used + len) cap *= 2;
+        char *grown = realloc(r->text, cap);
+        if (grown == NULL) return -1;
+        r->text = grown;
+        r->cap = cap;
+    }
+    RenderSegment *last = r->count > 0 ? &r->segs[r->count - 1] : NULL;
+    if (copy && last && last->data == NULL && last->off + last->len == r->used) {
+        last->len += len;
+    } else {
+        if (r->count == r->segcap) {
+            int cap = r->segcap ? r->segcap * 2 : 16;
+            RenderSegment *grown = realloc(r->segs, cap * sizeof(RenderSegment));
+            if (grown == NULL) return -1;
+            r->segs = grown;
+            r->segcap = cap;
+        }
+        r->segs[r->count++] = (RenderSegment){copy ? NULL : data, copy ? r->used : 0, len};
+    }
+    if (copy) {
+        memcpy(r->text + r->used, data, len);
+        r->used += len;
+    }
+    r->len += len;
+    return 0;
+}
+
+static void render_reset(RenderBuffer *r) {
+    r->used = r->len = r->sent = 0;
+    r->count = r->next = 0;
+}
+
+static int render_write(RenderBuffer *r, int fd) {
+    while (r->len > 0) {
+        struct iovec iov[RENDER_IOV];
+        int n = 0;
+        for (int i = r->next; i < r->count && n < RENDER_IOV; i++, n++) {
+            const RenderSegment *seg = &r->segs[i];
+            size_t skip = i == r->next ? r->sent : 0;
+            iov[n].iov_base = (char *)(seg->data ? seg->data : r->text + seg->off) + skip;
+            iov[n].iov_len = seg->len - skip;
+        }
+        ssize_t wrote = writev(fd, iov, n);
+        if (wrote < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        r->len -= wrote;
+        while (wrote > 0) {
+            size_t left = r->segs[r->next].len - r->sent;
+            if ((size_t)wrote < left) {
+                r->sent += wrote;
+                break;
+            }
+            wrote -= left;
+            r->sent = 0;
+            r->next++;
+        }
+    }
+    render_reset(r);
+    return 0;
+}
+
+static void render_drain(Session *s) {
+    while (s->render.len > 0) {
+        if (render_write(&s->render, s->fd)) {
+            render_reset(&s->render);
+            return;
+        }
+        if (s->render.len > 0) {
+            struct pollfd pfd = {s->fd, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+        }
+    }
+}
+
+static ssize_t session_write(void *cookie, const char *buf, size_t size) {
+    Session *s = cookie;
+    if (render_append(&s->render, buf, size, 1)) return -1;
+    if (!s->remote && s->render.len >= RENDER_FLUSH) {
+        render_drain(s);
+    }
+    return size;
+}
+
+static FILE *session_stream(Session *s) {
+    cookie_io_functions_t io = {0};
+    io.write = session_write;
+    FILE *out = fopencookie(s, "w", io);
+    if (out) setvbuf(out, NULL, _IOFBF, 4096);
+    return out;
+}
+
+static void render_flush(Session *s) {
+    flockfile(s->out);
+    fflush(s->out);
+    render_drain(s);
+    funlockfile(s->out);
+}
+
+void sh_flush() {
+    fflush(sh_out);
+    if (sh_err != sh_out) fflush(sh_err);
+    if (!session->remote && session->out && (sh_out == session->out || sh_err == session->out)) {
+        render_flush(session);
+    }
+}
+
+static int same_file(int a, int b) {
+    struct stat x, y;
+    return fstat(a, &x) == 0 && fstat(b, &y) == 0 && x.st_dev == y.st_dev && x.st_ino == y.st_ino;
+}
+
+static void render_at_exit() {
+    if (local_session.out) render_flush(&local_session);
+}
+
+static void sh_static(const char *text, size_t len) {
+    if (sh_out != session->out) {
+        fwrite(text, 1, len, sh_out);
+        return;
+    }
+    flockfile(sh_out);
+    fflush(sh_out);
+    render_append(&session->render, text, len, 0);
+    funlockfile(sh_out);
+}
+
+static void show_screen(Screen *screen, void (*draw)()) {
+    int color = sh_color();
+    pthread_mutex_lock(&screen_lock);
+    if (screen->text[color] == NULL) {
+        FILE *saved = sh_out;
+        FILE *capture = open_memstream(&screen->text[color], &screen->len[color]);
+        if (capture) {
+            sh_out = capture;
+            screen_color = color;
+            draw();
+            screen_color = -1;
+            fclose(capture);
+            sh_out = saved;
+        }
+    }
+    pthread_mutex_unlock(&screen_lock);
+    if (screen->text[color]) {
+        sh_static(screen->text[color], screen->len[color]);
+    } else {
+        draw();
+    }
+}
+
+void sh_perror(const char *msg) {
+    fprintf(sh_err, "%s: %s\n", msg, strerror(errno));
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static ssize_t read_chunk(int fd, FILE *in, char *buf, size_t size) {
+    if (fd < 0) {
+        size_t n = fread(buf, 1, size, in);
+        return (n == 0 && ferror(in)) ? -1 : (ssize_t)n;
+    }
+    ssize_t n;
+    do {
+        n = read(fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) STAT_ADD(bytes_read, n);
+    return n;
+}
+
+static int write_chunk(int fd, const char *buf, size_t len) {
+    STAT_ADD(bytes_written, len);
+    if (fd < 0) {
+        return fwrite(buf, 1, len, sh_out) == len ? 0 : -1;
+    }
+    return write_all(fd, buf, len);
+}
+
+static int input_fd() {
+    if (sh_in == stdin) return -1;
+    return fileno(sh_in);
+}
+
+static int stream_fd(FILE *stream) {
+    if (stream == session->out && !session->remote) {
+        render_flush(session);
+        return session->fd;
+    }
+    fflush(stream);
+    return fileno(stream);
+}
+
+static int output_fd() {
+    return stream_fd(sh_out);
+}
+
+static int splice_all(int in_fd, int out_fd) {
+    for (;;) {
+        ssize_t n = splice(in_fd, NULL, out_fd, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == 0) return 0;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        STAT_ADD(bytes_read, n);
+        STAT_ADD(bytes_written, n);
+    }
+}
+
+static int is_pipe(int fd) {
+    struct stat st;
+    return fd >= 0 && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static EvidenceBlob *evidence_blob(const char *content, size_t len) {
+    EvidenceBlob *blob = malloc(sizeof(EvidenceBlob) + len);
+    if (blob == NULL) return NULL;
+    blob->refs = 1;
+    blob->len = len;
+    memcpy(blob->data, content, len);
+    return blob;
+}
+
+static void evidence_release(EvidenceBlob *blob);
+
+static size_t search_word(const char **p, const char *end, char *term) {
+    const char *s = *p;
+    while (s < end && !isalnum((unsigned char)*s)) s++;
+    size_t len = 0;
+    for (; s < end && isalnum((unsigned char)*s); s++) {
+        if (len < SEARCH_TERM - 1) term[len++] = tolower((unsigned char)*s);
+    }
+    term[len] = '\0';
+    *p = s;
+    return len;
+}
+
+static unsigned int search_hash(const char *term) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)term; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h | 1;
+}
+
+static SearchTerm *search_find(const SearchIndex *index, const char *term, unsigned int hash) {
+    if (index->term_cap == 0) return NULL;
+    for (unsigned int i = hash & (index->term_cap - 1);; i = (i + 1) & (index->term_cap - 1)) {
+        SearchTerm *slot = &index->terms[i];
+        if (slot->hash == 0) return NULL;
+        if (slot->hash == hash && strcmp(slot->term, term) == 0) return slot;
+    }
+}
+
+static SearchTerm *search_term(SearchIndex *index, const char *term) {
+    unsigned int hash = search_hash(term);
+    SearchTerm *slot = search_find(index, term, hash);
+    if (slot) return slot;
+
+    if ((index->term_count + 1) * 4 > index->term_cap * 3) {
+        unsigned int old_cap = index->term_cap;
+        SearchTerm *old = index->terms;
+        index->term_cap = old_cap ? old_cap * 2 : 256;
+        index->terms = calloc(index->term_cap, sizeof(SearchTerm));
+        for (unsigned int i = 0; i < old_cap; i++) {
+            if (old[i].hash == 0) continue;
+            unsigned int j = old[i].hash & (index->term_cap - 1);
+            while (index->terms[j].hash) j = (j + 1) & (index->term_cap - 1);
+            index->terms[j] = old[i];
+        }
+        free(old);
+    }
+    unsigned int i = hash & (index->term_cap - 1);
+    while (index->terms[i].hash) i = (i + 1) & (index->term_cap - 1);
+    slot = &index->terms[i];
+    slot->term = strdup(term);
+    slot->hash = hash;
+    index->term_count++;
+    return slot;
+}
+
+int search_add(SearchIndex *index, const char *name, EvidenceBlob *blob, const char *text, int suspect) {
+    if (index->doc_count == index->doc_cap) {
+        index->doc_cap = index->doc_cap ? index->doc_cap * 2 : 64;
+        index->docs = realloc(index->docs, index->doc_cap * sizeof(SearchDoc));
+    }
+    unsigned int id = index->doc_count++;
+    SearchDoc *doc = &index->docs[id];
+    snprintf(doc->name, sizeof(doc->name), "%s", name);
+    doc->blob = blob;
+    doc->text = text;
+    doc->suspect = suspect;
+    doc->live = 1;
+    if (blob) __atomic_add_fetch(&blob->refs, 1, __ATOMIC_RELAXED);
+
+    const char *p = blob ? blob->data : text;
+    const char *end = p + (blob ? blob->len : strlen(text));
+    char term[SEARCH_TERM];
+    while (search_word(&p, end, term)) {
+        SearchTerm *slot = search_term(index, term);
+        if (slot->count && slot->docs[slot->count - 1] == id) continue;
+        if (slot->count == slot->cap) {
+            slot->cap = slot->cap ? slot->cap * 2 : 4;
+            slot->docs = realloc(slot->docs, slot->cap * sizeof(unsigned int));
+        }
+        slot->docs[slot->count++] = id;
+    }
+    return id;
+}
+
+static void search_compact(SearchIndex *index, EvidenceStore *store) {
+    int *remap = malloc(index->doc_count * sizeof(int));
+    int live = 0;
+    for (int i = 0; i < index->doc_count; i++) {
+        remap[i] = index->docs[i].live ? live : -1;
+        if (index->docs[i].live) index->docs[live++] = index->docs[i];
+    }
+    for (unsigned int i = 0; i < index->term_cap; i++) {
+        SearchTerm *slot = &index->terms[i];
+        int kept = 0;
+        for (int j = 0; j < slot->count; j++) {
+            if (remap[slot->docs[j]] >= 0) slot->docs[kept++] = remap[slot->docs[j]];
+        }
+        slot->count = kept;
+    }
+    for (int i = 0; store && i < store->count; i++) {
+        if (store->entries[i].doc) store->entries[i].doc = remap[store->entries[i].doc - 1] + 1;
+    }
+    index->doc_count = live;
+    index->dead = 0;
+    free(remap);
+}
+
+static void search_retire(SearchIndex *index, EvidenceStore *store, int *doc) {
+    if (*doc == 0) return;
+    SearchDoc *old = &index->docs[*doc - 1];
+    old->live = 0;
+    evidence_release(old->blob);
+    old->blob = NULL;
+    *doc = 0;
+    if (++index->dead > SEARCH_COMPACT && index->dead * 2 > index->doc_count) {
+        search_compact(index, store);
+    }
+}
+
+void search_clear(SearchIndex *index) {
+    for (int i = 0; i < index->doc_count; i++) {
+        evidence_release(index->docs[i].blob);
+    }
+    for (unsigned int i = 0; i < index->term_cap; i++) {
+        free(index->terms[i].term);
+        free(index->terms[i].docs);
+    }
+    free(index->terms);
+    free(index->docs);
+    memset(index, 0, sizeof(*index));
+}
+
+static int search_seek(const SearchTerm *slot, int pos, unsigned int id) {
+    int step = 1;
+    while (pos + step < slot->count && slot->docs[pos + step] < id) {
+        pos += step;
+        step *= 2;
+    }
+    int lo = pos, hi = pos + step < slot->count ? pos + step + 1 : slot->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (slot->docs[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int compare_term_counts(const void *a, const void *b) {
+    return (*(const SearchTerm * const *)a)->count - (*(const SearchTerm * const *)b)->count;
+}
+
+int search_run(const SearchIndex *index, char terms[][SEARCH_TERM], int count, const GameState *game,
+               void (*found)(const SearchDoc *doc, void *arg), void *arg) {
+    const SearchTerm *slots[SEARCH_MAX_TERMS];
+    if (count == 0) return 0;
+    for (int i = 0; i < count; i++) {
+        slots[i] = search_find(index, terms[i], search_hash(terms[i]));
+        if (slots[i] == NULL) return 0;
+    }
+    qsort(slots, count, sizeof(slots[0]), compare_term_counts);
+
+    int matches = 0, cursor[SEARCH_MAX_TERMS] = {0};
+    for (int i = 0; i < slots[0]->count; i++) {
+        unsigned int id = slots[0]->docs[i];
+        int all = 1;
+        for (int j = 1; j < count && all; j++) {
+            cursor[j] = search_seek(slots[j], cursor[j], id);
+            all = cursor[j] < slots[j]->count && slots[j]->docs[cursor[j]] == id;
+        }
+        const SearchDoc *doc = &index->docs[id];
+        if (!all || !doc->live || (doc->suspect >= 0 && !BIT_TEST(game->interviewed, doc->suspect))) continue;
+        matches++;
+        if (found) found(doc, arg);
+    }
+    return matches;
+}
+
+pthread_mutex_t evidence_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t evidence_work = PTHREAD_COND_INITIALIZER;
+pthread_cond_t evidence_done = PTHREAD_COND_INITIALIZER;
+EvidenceJob *evidence_queue;
+EvidenceJob **evidence_tail = &evidence_queue;
+int evidence_writer;
+int evidence_busy;
+
+static void evidence_release(EvidenceBlob *blob) {
+    if (blob && __atomic_sub_fetch(&blob->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(blob);
+    }
+}
+
+static EvidenceEntry *evidence_find(EvidenceStore *store, const char *name) {
+    for (int i = 0; i < store->count; i++) {
+        if (strcmp(store->entries[i].name, name) == 0) return &store->entries[i];
+    }
+    return NULL;
+}
+
+static void evidence_install(EvidenceStore *store, EvidenceEntry *entry, EvidenceBlob *blob) {
+    evidence_release(entry->blob);
+    entry->blob = blob;
+    entry->stale = 0;
+    search_retire(&store->index, store, &entry->doc);
+    entry->doc = search_add(&store->index, entry->name, blob, NULL, -1) + 1;
+}
+
+static EvidenceEntry *evidence_entry(EvidenceStore *store, const char *name) {
+    EvidenceEntry *entry = evidence_find(store, name);
+    if (entry) return entry;
+    if (store->count == store->cap) {
+        store->cap = store->cap ? store->cap * 2 : 16;
+        store->entries = realloc(store->entries, store->cap * sizeof(EvidenceEntry));
+    }
+    entry = &store->entries[store->count++];
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    if (store == &local_session.store) {
+        complete_add(&completer, name, COMPLETE_FILE);
+    }
+    return entry;
+}
+
+static void *evidence_write_behind(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&evidence_lock);
+    for (;;) {
+        while (evidence_queue == NULL) {
+            pthread_cond_wait(&evidence_work, &evidence_lock);
+        }
+        EvidenceJob *batch = evidence_queue;
+        evidence_queue = NULL;
+        evidence_tail = &evidence_queue;
+        for (EvidenceJob *job = batch; job; job = job->next) {
+            job->store->entries[job->entry].job = NULL;
+        }
+        evidence_busy = 1;
+        pthread_mutex_unlock(&evidence_lock);
+
+        for (EvidenceJob *job = batch; job; job = job->next) {
+            int fd = openat(job->dir_fd, job->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd == -1 || write_all(fd, job->blob->data, job->blob->len) || fstat(fd, &job->st)) {
+                job->error = errno;
+            }
+            if (fd != -1) close(fd);
+        }
+
+        pthread_mutex_lock(&evidence_lock);
+        while (batch) {
+            EvidenceJob *job = batch;
+            EvidenceEntry *entry = &job->store->entries[job->entry];
+            batch = job->next;
+            if (job->error) {
+                job->store->error = job->error;
+            } else {
+                entry->ino = job->st.st_ino;
+                entry->size = job->st.st_size;
+                entry->mtime = job->st.st_mtim;
+                entry->unsynced = 1;
+            }
+            entry->pending--;
+            __atomic_sub_fetch(&job->store->pending, 1, __ATOMIC_RELEASE);
+            evidence_release(job->blob);
+            free(job);
+        }
+        evidence_busy = 0;
+        pthread_cond_broadcast(&evidence_done);
+    }
+    return NULL;
+}
+
+static void evidence_before_fork() {
+    pthread_mutex_lock(&evidence_lock);
+    while (evidence_busy) {
+        pthread_cond_wait(&evidence_done, &evidence_lock);
+    }
+}
+
+static void evidence_after_fork() {
+    pthread_mutex_unlock(&evidence_lock);
+}
+
+static void evidence_in_child() {
+    evidence_writer = 0;
+    pthread_mutex_init(&evidence_lock, NULL);
+    pthread_cond_init(&evidence_work, NULL);
+    pthread_cond_init(&evidence_done, NULL);
+}
+
+static void evidence_wake() {
+    if (evidence_writer == 0) {
+        static int registered;
+        pthread_t thread;
+        if (!registered) {
+            pthread_atfork(evidence_before_fork, evidence_after_fork, evidence_in_child);
+            registered = 1;
+        }
+        if (pthread_create(&thread, NULL, evidence_write_behind, NULL) == 0) {
+            pthread_detach(thread);
+            evidence_writer = 1;
+        }
+    }
+    pthread_cond_signal(&evidence_work);
+}
+
+void evidence_open(EvidenceStore *store, const char *dir) {
+    evidence_close(store);
+    store->dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    store->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (store->dir_fd == -1 || store->watch_fd == -1 ||
+        inotify_add_watch(store->watch_fd, dir, IN_CLOSE_WRITE | IN_MOVE | IN_DELETE) == -1) {
+        if (store->dir_fd != -1) close(store->dir_fd);
+        if (store->watch_fd != -1) close(store->watch_fd);
+        return;
+    }
+    store->open = 1;
+}
+
+void evidence_flush(EvidenceStore *store) {
+    if (!store->open || __atomic_load_n(&store->pending, __ATOMIC_ACQUIRE) == 0) return;
+    pthread_mutex_lock(&evidence_lock);
+    if (store->pending) {
+        evidence_wake();
+    }
+    while (store->pending) {
+        pthread_cond_wait(&evidence_done, &evidence_lock);
+    }
+    pthread_mutex_unlock(&evidence_lock);
+}
+
+void evidence_drop(EvidenceStore *store) {
+    if (!store->open) return;
+    evidence_flush(store);
+    pthread_mutex_lock(&evidence_lock);
+    for (int i = 0; i < store->count; i++) {
+        evidence_release(store->entries[i].blob);
+        if (store == &local_session.store) {
+            complete_remove(&completer, store->entries[i].name, COMPLETE_FILE);
+        }
+    }
+    store->count = 0;
+    search_clear(&store->index);
+    pthread_mutex_unlock(&evidence_lock);
+}
+
+void evidence_close(EvidenceStore *store) {
+    if (!store->open) return;
+    evidence_drop(store);
+    free(store->entries);
+    close(store->dir_fd);
+    close(store->watch_fd);
+    memset(store, 0, sizeof(*store));
+}
+
+int evidence_put(EvidenceStore *store, const char *name, const char *content, size_t len) {
+    if (!store->open || strlen(name) >= EVIDENCE_NAME || strchr(name, '/')) return -1;
+    EvidenceBlob *blob = evidence_blob(content, len);
+    if (blob == NULL) return -1;
+
+    pthread_mutex_lock(&evidence_lock);
+    EvidenceEntry *entry = evidence_entry(store, name);
+    evidence_install(store, entry, blob);
+
+    __atomic_add_fetch(&blob->refs, 1, __ATOMIC_RELAXED);
+    if (entry->job) {
+        evidence_release(entry->job->blob);
+        entry->job->blob = blob;
+    } else {
+        EvidenceJob *job = calloc(1, sizeof(EvidenceJob));
+        job->store = store;
+        job->entry = entry - store->entries;
+        job->blob = blob;
+        job->dir_fd = store->dir_fd;
+        snprintf(job->name, sizeof(job->name), "%s", name);
+        *evidence_tail = job;
+        evidence_tail = &job->next;
+        entry->job = job;
+        entry->pending++;
+        __atomic_add_fetch(&store->pending, 1, __ATOMIC_RELEASE);
+        evidence_wake();
+    }
+    pthread_mutex_unlock(&evidence_lock);
+    return 0;
+}
+
+static void evidence_poll(EvidenceStore *store) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(store->watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                for (int i = 0; i < store->count; i++) {
+                    if (!store->entries[i].pending) store->entries[i].stale = 1;
+                }
+                continue;
+            }
+            EvidenceEntry *entry = event->len ? evidence_find(store, event->name) : NULL;
+            if (entry == NULL || entry->pending) continue;
+
+            struct stat st;
+            if (fstatat(store->dir_fd, entry->name, &st, 0) == -1 || st.st_ino != entry->ino || st.st_size != entry->size ||
+                st.st_mtim.tv_sec != entry->mtime.tv_sec || st.st_mtim.tv_nsec != entry->mtime.tv_nsec) {
+                entry->stale = 1;
+            }
+        }
+    }
+}
+
+static EvidenceBlob *evidence_load(EvidenceStore *store, const char *name, struct stat *st) {
+    int fd = openat(store->dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    EvidenceBlob *blob = NULL;
+    if (fstat(fd, st) == 0 && S_ISREG(st->st_mode) && st->st_size <= EVIDENCE_MAX_FILE && (blob = malloc(sizeof(EvidenceBlob) + st->st_size))) {
+        blob->refs = 1;
+        blob->len = 0;
+        ssize_t n;
+        while (blob->len < (size_t)st->st_size && (n = read_chunk(fd, NULL, blob->data + blob->len, st->st_size - blob->len)) > 0) {
+            blob->len += n;
+        }
+    }
+    close(fd);
+    return blob;
+}
+
+static EvidenceBlob *evidence_get(EvidenceStore *store, const char *name) {
+    if (!store->open || strlen(name) >= EVIDENCE_NAME || strchr(name, '/')) return NULL;
+    pthread_mutex_lock(&evidence_lock);
+    evidence_poll(store);
+    EvidenceEntry *entry = evidence_find(store, name);
+    EvidenceBlob *blob = NULL;
+    if (entry && !entry->stale) {
+        blob = entry->blob;
+        __atomic_add_fetch(&blob->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&evidence_lock);
+    if (blob) return blob;
+
+    struct stat st;
+    blob = evidence_load(store, name, &st);
+    if (blob == NULL) {
+        pthread_mutex_lock(&evidence_lock);
+        entry = evidence_find(store, name);
+        if (entry && entry->stale) {
+            search_retire(&store->index, store, &entry->doc);
+        }
+        pthread_mutex_unlock(&evidence_lock);
+        return NULL;
+    }
+    pthread_mutex_lock(&evidence_lock);
+    entry = evidence_entry(store, name);
+    if (entry->blob == NULL || entry->stale) {
+        evidence_install(store, entry, blob);
+        entry->ino = st.st_ino;
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtim;
+        __atomic_add_fetch(&blob->refs, 1, __ATOMIC_RELAXED);
+    } else {
+        evidence_release(blob);
+        blob = entry->blob;
+        __atomic_add_fetch(&blob->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&evidence_lock);
+    return blob;
+}
+
+int evidence_sync(EvidenceStore *store) {
+    int synced = 0;
+    evidence_flush(store);
+    for (int i = 0; i < store->count; i++) {
+        EvidenceEntry *entry = &store->entries[i];
+        if (!entry->unsynced) continue;
+        int fd = openat(store->dir_fd, entry->name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || fsync(fd) == -1) {
+            store->error = errno;
+        } else {
+            entry->unsynced = 0;
+            synced++;
+        }
+        if (fd != -1) close(fd);
+    }
+    if (synced && fsync(store->dir_fd) == -1) {
+        store->error = errno;
+    }
+    return synced;
+}
+
+typedef struct {
+    char (*terms)[SEARCH_TERM];
+    int count;
+    int shown;
+    SearchDoc hits[SEARCH_SHOWN];
+} SearchHits;
+
+static void collect_search_hit(const SearchDoc *doc, void *arg) {
+    SearchHits *hits = arg;
+    if (hits->shown == SEARCH_SHOWN) return;
+    hits->hits[hits->shown] = *doc;
+    if (doc->blob) __atomic_add_fetch(&doc->blob->refs, 1, __ATOMIC_RELAXED);
+    hits->shown++;
+}
+
+static int line_mentions(const char *line, const char *end, char terms[][SEARCH_TERM], int count) {
+    char word[SEARCH_TERM];
+    while (search_word(&line, end, word)) {
+        for (int i = 0; i < count; i++) {
+            if (strcmp(word, terms[i]) == 0) return 1;
+        }
+    }
+    return 0;
+}
+
+static void print_search_hit(const SearchDoc *doc, char terms[][SEARCH_TERM], int count) {
+    const char *name = doc->suspect >= 0 ? suspect_name(doc->suspect) : doc->name;
+    const char *p = doc->blob ? doc->blob->data : doc->text;
+    const char *end = p + (doc->blob ? doc->blob->len : strlen(doc->text));
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL) eol = end;
+        if (line_mentions(p, eol, terms, count)) {
+            sh_styled(STYLE_SPEAKER, "%s:", name);
+            sh_printf(" %.*s\n", (int)(eol - p), p);
+        }
+        p = eol + 1;
+    }
+}
+
+static void refresh_stale_evidence(EvidenceStore *store) {
+    char (*names)[EVIDENCE_NAME] = NULL;
+    int stale = 0;
+    if (!store->open) return;
+    pthread_mutex_lock(&evidence_lock);
+    evidence_poll(store);
+    for (int i = 0; i < store->count; i++) {
+        if (!store->entries[i].stale) continue;
+        names = realloc(names, (stale + 1) * sizeof(*names));
+        memcpy(names[stale++], store->entries[i].name, EVIDENCE_NAME);
+    }
+    pthread_mutex_unlock(&evidence_lock);
+    for (int i = 0; i < stale; i++) {
+        evidence_release(evidence_get(store, names[i]));
+    }
+    free(names);
+}
+
+void cmd_search(char **args) {
+    char terms[SEARCH_MAX_TERMS][SEARCH_TERM];
+    int count = 0;
+    for (int i = 1; args[i] && count < SEARCH_MAX_TERMS; i++) {
+        const char *p = args[i], *end = p + strlen(p);
+        while (count < SEARCH_MAX_TERMS && search_word(&p, end, terms[count])) count++;
+    }
+    if (count == 0) {
+        sh_printf("Usage: search [terms]\n");
+        return;
+    }
+
+    SearchHits hits = {.terms = terms, .count = count};
+    refresh_stale_evidence(&session->store);
+    unsigned long long begin = now_ns();
+    pthread_mutex_lock(&evidence_lock);
+    int matches = search_run(&session->store.index, terms, count, &session->game, collect_search_hit, &hits);
+    pthread_mutex_unlock(&evidence_lock);
+    matches += search_run(&dialogue_index, terms, count, &session->game, collect_search_hit, &hits);
+    unsigned long long elapsed = now_ns() - begin;
+
+    if (matches == 0) {
+        sh_printf("Nothing in your evidence or interviews mentions that.\n");
+        return;
+    }
+    sh_printf("\n");
+    for (int i = 0; i < hits.shown; i++) {
+        print_search_hit(&hits.hits[i], terms, count);
+        evidence_release(hits.hits[i].blob);
+    }
+    if (matches > hits.shown) {
+        sh_printf("... and %d more\n", matches - hits.shown);
+    }
+    sh_printf("\n%d match%s in %.0f us\n", matches, matches == 1 ? "" : "es", elapsed / 1e3);
+}
+
+static int rev_lines(int out, const char *data, size_t len, int release);
+
+static int cached_case_file(const char *filename, int reverse) {
+    EvidenceBlob *blob = evidence_get(&session->store, filename);
+    if (blob == NULL) return -1;
+    if (!reverse) {
+        write_chunk(output_fd(), blob->data, blob->len);
+    } else {
+        rev_lines(output_fd(), blob->data, blob->len, 0);
+    }
+    evidence_release(blob);
+    return 0;
+}
+
+static int sendfile_all(int in_fd, int out_fd, off_t size) {
+    off_t sent = 0;
+    while (sent < size) {
+        ssize_t n = sendfile(out_fd, in_fd, NULL, size - sent < (1 << 30) ? size - sent : (1 << 30));
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return sent == 0 ? -1 : 1;
+        }
+        sent += n;
+        STAT_ADD(bytes_read, n);
+        STAT_ADD(bytes_written, n);
+    }
+    return 0;
+}
+
+/* Server sessions see their case files by name only, never the directory they live in. */
+static const char *shown_path(const char *path) {
+    size_t len = strlen(session->case_dir);
+    if (session->remote && strncmp(path, session->case_dir, len) == 0 && path[len] == '/') return path + len + 1;
+    return path;
+}
+
+int native_cat(const char *path) {
+    char buf[STREAM_CHUNK];
+    int fd = path ? open(path, O_RDONLY) : input_fd();
+    if (path && fd == -1) {
+        fprintf(sh_err, "cat: %s: %s\n", shown_path(path), strerror(errno));
+        return 1;
+    }
+
+    int out = output_fd();
+    if (fd >= 0 && (is_pipe(out) || is_pipe(fd)) && splice_all(fd, out) == 0) {
+        if (path) close(fd);
+        return 0;
+    }
+    struct stat st;
+    if (fd >= 0 && out >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        int sent = sendfile_all(fd, out, st.st_size);
+        if (sent >= 0) {
+            if (sent > 0 && errno != EPIPE) fprintf(sh_err, "cat: write error: %s\n", strerror(errno));
+            if (path) close(fd);
+            return sent;
+        }
+    }
+
+    ssize_t n;
+    while ((n = read_chunk(fd, sh_in, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            fprintf(sh_err, "cat: %s: %s\n", path ? shown_path(path) : "-", strerror(errno));
+            break;
+        }
+        if (write_chunk(out, buf, n)) {
+            if (errno != EPIPE) fprintf(sh_err, "cat: write error: %s\n", strerror(errno));
+            break;
+        }
+    }
+    if (path) close(fd);
+    return n == 0 ? 0 : 1;
+}
+
+static void reverse_copy(char *dst, const char *src, size_t len) {
+    const char *end = src + len;
+#ifdef __AVX2__
+    const __m256i flip = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                          15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    while (end - src >= 32) {
+        end -= 32;
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)end), flip);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_permute2x128_si256(v, v, 1));
+        dst += 32;
+    }
+#endif
+#ifdef __SSE2__
+    while (end - src >= 16) {
+        end -= 16;
+        __m128i v = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)end), _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+        dst += 16;
+    }
+#endif
+    while (end > src) *dst++ = *--end;
+}
+
+static void stream_release(const char *from, const char *to) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t a = ((uintptr_t)from + page - 1) & ~(page - 1), b = (uintptr_t)to & ~(page - 1);
+    if (a < b) madvise((void *)a, b - a, MADV_DONTNEED);
+}
+
+static int rev_lines(int out, const char *data, size_t len, int release) {
+    char buf[STREAM_CHUNK];
+    size_t used = 0;
+    const char *p = data, *end = data + len, *kept = data;
+
+    while (p < end) {
+        const char *nl = NULL;
+        for (const char *scan = p; scan < end; scan += STREAM_RELEASE) {
+            size_t span = end - scan < STREAM_RELEASE ? (size_t)(end - scan) : STREAM_RELEASE;
+            if ((nl = memchr(scan, '\n', span)) != NULL) break;
+            if (release) stream_release(scan, scan + span);
+        }
+        const char *stop = nl ? nl : end;
+        size_t line = stop - p;
+        if (used + line + 1 > sizeof(buf)) {
+            if (write_chunk(out, buf, used)) return -1;
+            used = 0;
+        }
+        if (line + 1 <= sizeof(buf)) {
+            reverse_copy(buf + used, p, line);
+            used += line;
+        } else {
+            for (const char *q = stop; q > p;) {
+                size_t take = q - p < (ptrdiff_t)sizeof(buf) ? (size_t)(q - p) : sizeof(buf);
+                q -= take;
+                reverse_copy(buf, q, take);
+                if (write_chunk(out, buf, take)) return -1;
+                if (release) stream_release(q, stop);
+            }
+        }
+        if (nl) buf[used++] = '\n';
+        p = stop + (nl != NULL);
+        if (release && p - kept >= STREAM_RELEASE) {
+            stream_release(kept, p);
+            kept = p;
+        }
+    }
+    return used ? write_chunk(out, buf, used) : 0;
+}
+
+/* Writes the spilled head of a long line reversed, reading it back from the end. */
+static int rev_spilled(int out, int spill, off_t size) {
+    char buf[STREAM_CHUNK], flipped[STREAM_CHUNK];
+    while (size > 0) {
+        size_t take = size < (off_t)sizeof(buf) ? (size_t)size : sizeof(buf);
+        size -= take;
+        if (pread(spill, buf, take, size) != (ssize_t)take) return -1;
+        reverse_copy(flipped, buf, take);
+        if (write_chunk(out, flipped, take)) return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reverses lines read from a pipe. A line longer than STREAM_RELEASE is spilled to a
+ * temporary file, so memory stays bounded. Returns -1 on a write error like
+ * sendfile_all, 1 if the input or the spill file failed.
+ */
+static int rev_stream(int fd, FILE *in) {
+    size_t cap = STREAM_CHUNK, len = 0;
+    char *buf = malloc(cap);
+    FILE *spill = NULL;
+    off_t spilled = 0;
+    int status = 0;
+    ssize_t n;
+
+    int out = output_fd();
+    while ((n = read_chunk(fd, in, buf + len, cap - len)) > 0) {
+        char *nl = spilled ? memchr(buf + len, '\n', n) : NULL;
+        len += n;
+        if (nl != NULL) {
+            size_t tail = nl - buf;
+            if (rev_lines(out, buf, tail, 0) || rev_spilled(out, fileno(spill), spilled) || write_chunk(out, "\n", 1)) {
+                status = -1;
+                break;
+            }
+            if (ftruncate(fileno(spill), 0)) {
+                status = 1;
+                break;
+            }
+            spilled = 0;
+            memmove(buf, nl + 1, len - tail - 1);
+            len -= tail + 1;
+        }
+        char *last = memrchr(buf, '\n', len);
+        if (last == NULL) {
+            if (len < cap) continue;
+            if (cap < STREAM_RELEASE) {
+                cap *= 2;
+                buf = realloc(buf, cap);
+                continue;
+            }
+            if (spill == NULL && (spill = tmpfile()) == NULL) {
+                status = 1;
+                break;
+            }
+            if (pwrite(fileno(spill), buf, len, spilled) != (ssize_t)len) {
+                status = 1;
+                break;
+            }
+            spilled += len;
+            len = 0;
+            continue;
+        }
+        size_t done = last + 1 - buf;
+        if (rev_lines(out, buf, done, 0)) {
+            status = -1;
+            break;
+        }
+        memmove(buf, buf + done, len - done);
+        len -= done;
+    }
+    if (status == 0 && n < 0) status = 1;
+    if (status == 0 && (len > 0 || spilled > 0)) {
+        if (rev_lines(out, buf, len, 0) || (spilled && rev_spilled(out, fileno(spill), spilled))) status = -1;
+    }
+    if (status > 0) fprintf(sh_err, "rev: %s\n", strerror(errno));
+
+    if (spill) fclose(spill);
+    free(buf);
+    return status;
+}
+
+int native_rev(const char *path) {
+    int fd = path ? open(path, O_RDONLY) : input_fd();
+    if (path && fd == -1) {
+        fprintf(sh_err, "rev: cannot open %s: %s\n", shown_path(path), strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    const char *map = MAP_FAILED;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    int status = 0;
+    if (map != MAP_FAILED) {
+        madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+        STAT_ADD(bytes_read, st.st_size);
+        if (rev_lines(output_fd(), map, st.st_size, 1)) {
+            if (errno != EPIPE) fprintf(sh_err, "rev: write error: %s\n", strerror(errno));
+            status = 1;
+        }
+        munmap((void *)map, st.st_size);
+    } else {
+        int streamed = rev_stream(fd, sh_in);
+        if (streamed < 0 && errno != EPIPE) fprintf(sh_err, "rev: write error: %s\n", strerror(errno));
+        status = streamed != 0;
+    }
+    if (path) close(fd);
+    return status;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int native_ls(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        fprintf(sh_err, "ls: cannot access '%s': %s\n", dir, strerror(errno));
+        return 2;
+    }
+
+    int count = 0, cap = 64;
+    char **names = malloc(cap * sizeof(char*));
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        if (count == cap) {
+            cap *= 2;
+            names = realloc(names, cap * sizeof(char*));
+        }
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(d);
+    qsort(names, count, sizeof(char*), compare_names);
+
+    int out = output_fd();
+    if (out < 0 || !isatty(out)) {
+        for (int i = 0; i < count; i++) {
+            sh_printf("%s\n", names[i]);
+        }
+    } else if (count > 0) {
+        struct winsize ws;
+        int width = 80;
+        char *columns = getenv("COLUMNS");
+        if (ioctl(out, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+            width = ws.ws_col;
+        } else if (columns && atoi(columns) > 0) {
+            width = atoi(columns);
+        }
+
+        int cols, rows = count;
+        for (cols = count; cols > 1; cols--) {
+            rows = (count + cols - 1) / cols;
+            int total = 0;
+            for (int c = 0; c * rows < count; c++) {
+                int widest = 0;
+                for (int k = c * rows; k < (c + 1) * rows && k < count; k++) {
+                    int l = strlen(names[k]);
+                    if (l > widest) widest = l;
+                }
+                total += widest + ((c + 1) * rows < count ? 2 : 0);
+            }
+            if (total <= width) break;
+        }
+        if (cols == 1) rows = count;
+
+        for (int r = 0; r < rows; r++) {
+            int pos = 0;
+            for (int idx = r; idx < count; idx += rows) {
+                sh_printf("%s", names[idx]);
+                if (idx + rows >= count) break;
+
+                int widest = 0;
+                int c = idx / rows;
+                for (int k = c * rows; k < (c + 1) * rows && k < count; k++) {
+                    int l = strlen(names[k]);
+                    if (l > widest) widest = l;
+                }
+                int from = pos + strlen(names[idx]);
+                pos += widest + 2;
+                while (from < pos) {
+                    if (pos / 8 > (from + 1) / 8) {
+                        fputc('\t', sh_out);
+                        from += 8 - from % 8;
+                    } else {
+                        fputc(' ', sh_out);
+                        from++;
+                    }
+                }
+            }
+            sh_printf("\n");
+        }
+    }
+    sh_flush();
+
+    for (int i = 0; i < count; i++) free(names[i]);
+    free(names);
+    return 0;
+}
+
+static unsigned long long disk_usage(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) == -1) {
+        fprintf(sh_err, "du: cannot access '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+    unsigned long long total = (unsigned long long)st.st_blocks * 512;
+    if (!S_ISDIR(st.st_mode)) return total;
+
+    DIR *d = opendir(path);
+    if (d == NULL) {
+        fprintf(sh_err, "du: cannot read directory '%s': %s\n", path, strerror(errno));
+        return total;
+    }
+    struct dirent *entry;
+    char child[1024];
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        total += disk_usage(child);
+    }
+    closedir(d);
+    return total;
+}
+
+static void human_size(unsigned long long bytes, char *buf, size_t size) {
+    const char *units = "KMGTPE";
+    if (bytes < 1024) {
+        snprintf(buf, size, "%llu", bytes);
+        return;
+    }
+
+    int unit = 0;
+    unsigned long long scale = 1024;
+    while (unit < 5 && bytes >= scale * 1024) {
+        scale *= 1024;
+        unit++;
+    }
+
+    if (bytes < 10 * scale) {
+        unsigned long long tenths = (bytes * 10 + scale - 1) / scale;
+        if (tenths < 100) {
+            snprintf(buf, size, "%llu.%llu%c", tenths / 10, tenths % 10, units[unit]);
+            return;
+        }
+    }
+    unsigned long long whole = (bytes + scale - 1) / scale;
+    if (whole >= 1024 && unit < 5) {
+        snprintf(buf, size, "1.0%c", units[unit + 1]);
+        return;
+    }
+    snprintf(buf, size, "%llu%c", whole, units[unit]);
+}
+
+int native_du(const char *dir) {
+    char size[32];
+    human_size(disk_usage(dir), size, sizeof(size));
+    sh_printf("%s\t%s\n", size, dir);
+    return 0;
+}
+
+int native_date() {
+    char buf[128];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(buf, sizeof(buf), "%a %b %e %H:%M:%S %Z %Y", &tm);
+    sh_printf("%s\n", buf);
+    return 0;
+}
+
+void init_launcher() {
+    char *env = getenv("NOIRE_LAUNCHER");
+    if (env == NULL) return;
+    for (int i = 0; i <= LAUNCH_FORK; i++) {
+        if (strcmp(env, launch_mode_names[i]) == 0) {
+            launch_mode = i;
+            return;
+        }
+    }
+    fprintf(stderr, "NOIRE_LAUNCHER: unknown mode '%s', using %s\n", env, launch_mode_names[launch_mode]);
+}
+
+void cmd_launcher(char **args) {
+    if (args[1] == NULL) {
+        sh_printf("External programs are started with %s\n", launch_mode_names[launch_mode]);
+        return;
+    }
+    for (int i = 0; i <= LAUNCH_FORK; i++) {
+        if (strcmp(args[1], launch_mode_names[i]) == 0) {
+            launch_mode = i;
+            return;
+        }
+    }
+    sh_printf("Usage: launcher [spawn|vfork|fork]\n");
+}
+
+static void report_launch_error(const char *name, int err) {
+    if (err == ENOENT) {
+        fprintf(sh_err, "Command not recognized. Type 'help' for options.\n");
+    } else {
+        fprintf(sh_err, "%s: %s\n", name, strerror(err));
+    }
+}
+
+typedef struct {
+    char **argv;
+    int in_fd;
+    int out_fd;
+    int err_fd;
+    int grouped;
+    pid_t pgid;
+    sigset_t mask;
+    volatile int err;
+} LaunchRequest;
+
+static void setup_child_fds(const LaunchRequest *req) {
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    if (req->grouped) {
+        setpgid(0, req->pgid);
+    }
+    if (req->in_fd >= 0 && req->in_fd != STDIN_FILENO) {
+        dup2(req->in_fd, STDIN_FILENO);
+    }
+    if (req->out_fd >= 0 && req->out_fd != STDOUT_FILENO) {
+        dup2(req->out_fd, STDOUT_FILENO);
+    }
+    if (req->err_fd >= 0 && req->err_fd != STDERR_FILENO) {
+        dup2(req->err_fd, STDERR_FILENO);
+    }
+}
+
+static pid_t launch_with_fork(LaunchRequest *req) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        setup_child_fds(req);
+        sigprocmask(SIG_SETMASK, &launch_mask, NULL);
+        execvp(req->argv[0], req->argv);
+        report_launch_error(req->argv[0], errno);
+        sh_flush();
+        _exit(127);
+    }
+    if (pid < 0) {
+        sh_perror("fork failed");
+    }
+    return pid;
+}
+
+static int vfork_child(void *arg) {
+    LaunchRequest *req = arg;
+    setup_child_fds(req);
+    sigprocmask(SIG_SETMASK, &launch_mask, NULL);
+    execvp(req->argv[0], req->argv);
+    req->err = errno;
+    _exit(127);
+}
+
+static pid_t launch_with_vfork(LaunchRequest *req) {
+    size_t stack_size = 64 * 1024;
+    char *stack = mmap(NULL, stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        sh_perror("mmap failed");
+        return -1;
+    }
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &req->mask);
+    req->err = 0;
+    pid_t pid = clone(vfork_child, stack + stack_size, CLONE_VM | CLONE_VFORK | SIGCHLD, req);
+    int clone_errno = errno;
+    pthread_sigmask(SIG_SETMASK, &req->mask, NULL);
+    munmap(stack, stack_size);
+
+    if (pid < 0) {
+        errno = clone_errno;
+        sh_perror("clone failed");
+        return -1;
+    }
+    if (req->err) {
+        waitpid(pid, NULL, 0);
+        report_launch_error(req->argv[0], req->err);
+        return -1;
+    }
+    return pid;
+}
+
+static pid_t launch_with_spawn(LaunchRequest *req) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    pid_t pid;
+
+    posix_spawn_file_actions_init(&actions);
+    if (req->in_fd >= 0 && req->in_fd != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, req->in_fd, STDIN_FILENO);
+    }
+    if (req->out_fd >= 0 && req->out_fd != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, req->out_fd, STDOUT_FILENO);
+    }
+    if (req->err_fd >= 0 && req->err_fd != STDERR_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, req->err_fd, STDERR_FILENO);
+    }
+
+    posix_spawnattr_init(&attr);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGTTOU);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &launch_mask);
+    if (req->grouped) {
+        posix_spawnattr_setpgroup(&attr, req->pgid);
+    }
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK |
+                             (req->grouped ? POSIX_SPAWN_SETPGROUP : 0));
+
+    int err = posix_spawnp(&pid, req->argv[0], &actions, &attr, req->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err) {
+        report_launch_error(req->argv[0], err);
+        return -1;
+    }
+    return pid;
+}
+
+static pid_t spawn_request(LaunchRequest *req) {
+    unsigned long long begin = now_ns();
+    pid_t pid;
+
+    evidence_flush(&session->store);
+    sh_flush();
+    switch (launch_mode) {
+        case LAUNCH_VFORK:
+            pid = launch_with_vfork(req);
+            break;
+        case LAUNCH_FORK:
+            pid = launch_with_fork(req);
+            break;
+        default:
+            pid = launch_with_spawn(req);
+            break;
+    }
+    if (pid > 0) {
+        if (req->grouped) {
+            setpgid(pid, req->pgid ? req->pgid : pid);
+        }
+        STAT_ADD(forks, 1);
+        STAT_ADD(execs, 1);
+    }
+    stat_record(STAT_SPAWN, "spawn", begin);
+    return pid;
+}
+
+pid_t spawn_process(char **argv, int in_fd, int out_fd, int err_fd) {
+    LaunchRequest req = {.argv = argv, .in_fd = in_fd, .out_fd = out_fd, .err_fd = err_fd};
+    return spawn_request(&req);
+}
+
+int run_external(char **argv) {
+    int in = input_fd();
+    int out = output_fd();
+    int relay[2] = {-1, -1};
+
+    if (out < 0) {
+        if (pipe2(relay, O_CLOEXEC)) {
+            sh_perror("pipe failed");
+            return -1;
+        }
+        out = relay[1];
+    }
+
+    sh_flush();
+    int err = fileno(sh_err);
+    pid_t pid = spawn_process(argv, in, out, err < 0 ? out : err);
+    if (relay[1] >= 0) {
+        close(relay[1]);
+        char buf[65536];
+        ssize_t n;
+        while ((n = read_chunk(relay[0], NULL, buf, sizeof(buf))) > 0) {
+            fwrite(buf, 1, n, sh_out);
+        }
+        close(relay[0]);
+    }
+
+    int status = -1;
+    if (pid > 0) {
+        unsigned long long begin = now_ns();
+        waitpid(pid, &status, 0);
+        stat_record(STAT_WAIT, "wait", begin);
+    }
+    return status;
+}
+
+int external_tool_argv(const char *tool, const char *arg, char **argv, char *path, size_t size) {
+    int argc = 0;
+    argv[argc++] = (char *)tool;
+    if (strcmp(tool, "du") == 0) {
+        argv[argc++] = "-sh";
+    }
+    if (arg) {
+        if (case_file_path(path, size, arg)) return -1;
+        argv[argc++] = path;
+    } else if (strcmp(tool, "ls") == 0 || strcmp(tool, "du") == 0) {
+        argv[argc++] = session->case_dir;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+int run_external_tool(const char *tool, const char *arg) {
+    char path[256];
+    char *argv[4];
+    if (external_tool_argv(tool, arg, argv, path, sizeof(path)) < 0) return 1;
+    return run_external(argv);
+}
+
+void show_case_file(const char *filename) {
+    char path[256];
+    if (tool_is_external("examine")) {
+        run_external_tool("cat", filename);
+        return;
+    }
+    if (case_file_path(path, sizeof(path), filename)) return;
+    if (cached_case_file(filename, 0) == 0) return;
+    native_cat(path);
+}
+
+static int draw_prompt() {
+    const char *where = pack_string(pack_locations[session->game.progress % pack->location_count].name);
+    sh_styled(STYLE_ALERT, "[%s] detective@LA-Noire:~$", where);
+    sh_printf(" ");
+    return (int)strlen(where) + 25;
+}
+
+void print_prompt() {
+    if (!session->show_prompt) return;
+    draw_prompt();
+    sh_flush();
+}
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t pos;
+    size_t cap;
+    int history;
+    char *draft;
+} LineEditor;
+
+char *history_lines[HISTORY_SIZE];
+int history_first = 0;
+int history_count = 0;
+int history_fd = -1;
+struct termios editor_saved;
+unsigned char key_buf[256];
+int key_len = 0;
+int key_pos = 0;
+
+static const char *history_at(int i) {
+    return history_lines[(history_first + i) % HISTORY_SIZE];
+}
+
+static void history_add(const char *line, int save) {
+    if (*line == '\0' || (history_count > 0 && strcmp(history_at(history_count - 1), line) == 0)) return;
+    if (history_count == HISTORY_SIZE) {
+        free(history_lines[history_first]);
+        history_first = (history_first + 1) % HISTORY_SIZE;
+        history_count--;
+    }
+    history_lines[(history_first + history_count++) % HISTORY_SIZE] = strdup(line);
+    if (save && history_fd >= 0) {
+        dprintf(history_fd, "%s\n", line);
+    }
+}
+
+static void history_open() {
+    char path[512];
+    const char *file = getenv("NOIRE_HISTORY");
+    const char *home = getenv("HOME");
+    if (file == NULL) {
+        snprintf(path, sizeof(path), "%s/.noire_history", home ? home : ".");
+        file = path;
+    }
+
+    int lines = 0;
+    FILE *in = fopen(file, "r");
+    if (in) {
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t len;
+        while ((len = getline(&line, &cap, in)) > 0) {
+            if (line[len - 1] == '\n') line[len - 1] = '\0';
+            history_add(line, 0);
+            lines++;
+        }
+        free(line);
+        fclose(in);
+    }
+    if (lines > 2 * HISTORY_SIZE) {
+        FILE *out = fopen(file, "w");
+        for (int i = 0; out && i < history_count; i++) {
+            fprintf(out, "%s\n", history_at(i));
+        }
+        if (out) fclose(out);
+    }
+    history_fd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+}
+
+int editor_init() {
+    const char *term = getenv("TERM");
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || (term && strcmp(term, "dumb") == 0)) return -1;
+    if (tcgetattr(STDIN_FILENO, &editor_saved)) return -1;
+    history_open();
+    return 0;
+}
+
+static int terminal_columns() {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+    return 80;
+}
+
+static int editor_key() {
+    if (key_pos == key_len) {
+        ssize_t n;
+        do {
+            wait_for_input();
+            n = read(STDIN_FILENO, key_buf, sizeof(key_buf));
+        } while (n < 0 && (errno == EINTR || errno == EAGAIN));
+        if (n <= 0) return -1;
+        key_len = n;
+        key_pos = 0;
+    }
+    return key_buf[key_pos++];
+}
+
+static void editor_refresh(LineEditor *ed) {
+    int cols = terminal_columns();
+    sh_printf("\r");
+    int width = draw_prompt();
+    size_t start = 0, end = ed->len;
+    while (start < ed->pos && width + (int)(ed->pos - start) >= cols) start++;
+    while (end > ed->pos && width + (int)(end - start) >= cols) end--;
+    fwrite(ed->buf + start, 1, end - start, sh_out);
+    sh_printf("\033[0K\r");
+    if (width + ed->pos - start > 0) {
+        sh_printf("\033[%dC", (int)(width + ed->pos - start));
+    }
+    sh_flush();
+}
+
+static void editor_replace(LineEditor *ed, size_t from, size_t to, const char *text, size_t len) {
+    size_t need = ed->len - (to - from) + len + 1;
+    if (need > ed->cap) {
+        while (ed->cap < need) ed->cap *= 2;
+        ed->buf = realloc(ed->buf, ed->cap);
+    }
+    memmove(ed->buf + from + len, ed->buf + to, ed->len - to);
+    memcpy(ed->buf + from, text, len);
+    ed->len = ed->len - (to - from) + len;
+    ed->pos = from + len;
+    ed->buf[ed->len] = '\0';
+}
+
+static int completion_context(const char *buf, size_t pos, size_t *start) {
+    size_t stage = pos;
+    while (stage > 0 && buf[stage - 1] != '|') stage--;
+    size_t cmd = stage;
+    while (cmd < pos && buf[cmd] == ' ') cmd++;
+    size_t cmd_end = cmd;
+    while (cmd_end < pos && buf[cmd_end] != ' ') cmd_end++;
+    if (cmd_end == pos) {
+        *start = cmd;
+        return COMPLETE_COMMAND;
+    }
+
+    size_t word = pos;
+    while (word > cmd_end && buf[word - 1] != ' ') word--;
+    size_t prev = word;
+    while (prev > cmd_end && buf[prev - 1] == ' ') prev--;
+    *start = word;
+    if (prev > 0 && (buf[prev - 1] == '>' || buf[prev - 1] == '<')) return COMPLETE_FILE;
+
+    char *name = strndup(buf + cmd, cmd_end - cmd);
+    const Command *command = find_command(name);
+    free(name);
+    int kinds = command && command->complete ? command->complete : COMPLETE_FILE;
+    if (kinds & COMPLETE_JOINED) {
+        /* the handler joins its arguments into one name, so complete the rest of the line */
+        size_t arg = cmd_end;
+        while (arg < pos && buf[arg] == ' ') arg++;
+        *start = arg;
+    }
+    return kinds & ~COMPLETE_JOINED;
+}
+
+static void editor_complete(LineEditor *ed) {
+    size_t start;
+    int kinds = completion_context(ed->buf, ed->pos, &start);
+    char *prefix = strndup(ed->buf + start, ed->pos - start);
+    char *found[COMPLETE_SHOWN];
+    int count = complete_candidates(&completer, prefix, kinds, found, COMPLETE_SHOWN);
+    size_t typed = strlen(prefix);
+
+    if (count == 1) {
+        editor_replace(ed, start, ed->pos, found[0], strlen(found[0]));
+        if (kinds & (COMPLETE_COMMAND | COMPLETE_FILE)) editor_replace(ed, ed->pos, ed->pos, " ", 1);
+    } else if (count > 1) {
+        size_t common = strlen(found[0]);
+        for (int i = 0; i < count; i++) {
+            size_t j = 0;
+            while (j < common && tolower((unsigned char)found[i][j]) == tolower((unsigned char)found[0][j])) j++;
+            common = j;
+        }
+        if (common > typed && strncasecmp(found[0], prefix, typed) == 0) {
+            editor_replace(ed, start, ed->pos, found[0], common);
+        } else {
+            int cols = terminal_columns(), used = 0;
+            sh_printf("\n");
+            for (int i = 0; i < count; i++) {
+                int len = strlen(found[i]) + 2;
+                if (used > 0 && used + len > cols) {
+                    sh_printf("\n");
+                    used = 0;
+                }
+                sh_printf("%s  ", found[i]);
+                used += len;
+            }
+            sh_printf("%s\n", count == COMPLETE_SHOWN ? "..." : "");
+        }
+    } else {
+        sh_printf("\a");
+    }
+    for (int i = 0; i < count; i++) free(found[i]);
+    free(prefix);
+    editor_refresh(ed);
+}
+
+static void editor_history(LineEditor *ed, int step) {
+    int next = ed->history + step;
+    if (next < 0 || next > history_count) return;
+    if (ed->history == history_count) {
+        free(ed->draft);
+        ed->draft = strdup(ed->buf);
+    }
+    ed->history = next;
+    const char *text = next == history_count ? ed->draft : history_at(next);
+    editor_replace(ed, 0, ed->len, text, strlen(text));
+    editor_refresh(ed);
+}
+
+static int editor_escape(LineEditor *ed) {
+    int a = editor_key(), b = editor_key();
+    if (a == '[' && b >= '0' && b <= '9') {
+        if (editor_key() != '~') return 0;
+        if (b == '3' && ed->pos < ed->len) {
+            editor_replace(ed, ed->pos, ed->pos + 1, "", 0);
+        } else if (b == '1' || b == '7') {
+            ed->pos = 0;
+        } else if (b == '4' || b == '8') {
+            ed->pos = ed->len;
+        }
+        return 1;
+    }
+    if (a != '[' && a != 'O') return 0;
+    switch (b) {
+        case 'A': editor_history(ed, -1); return 0;
+        case 'B': editor_history(ed, 1); return 0;
+        case 'C': if (ed->pos < ed->len) ed->pos++; return 1;
+        case 'D': if (ed->pos > 0) ed->pos--; return 1;
+        case 'H': ed->pos = 0; return 1;
+        case 'F': ed->pos = ed->len; return 1;
+    }
+    return 0;
+}
+
+ssize_t edit_line(char **line, size_t *line_cap) {
+    LineEditor ed = {0};
+    ed.cap = 256;
+    ed.buf = malloc(ed.cap);
+    ed.buf[0] = '\0';
+    ed.history = history_count;
+
+    struct termios raw = editor_saved;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    ssize_t result = -1;
+    for (;;) {
+        int c = editor_key();
+        int redraw = 1;
+        if (c == -1 || (c == 4 && ed.len == 0)) {
+            break;
+        } else if (c == '\r' || c == '\n') {
+            sh_printf("\n");
+            history_add(ed.buf, 1);
+            result = ed.len + 1;
+            break;
+        } else if (c == 3) {
+            sh_printf("^C\n");
+            ed.len = ed.pos = 0;
+            ed.buf[0] = '\0';
+            result = 1;
+            break;
+        } else if (c == '\t') {
+            editor_complete(&ed);
+            redraw = 0;
+        } else if (c == 127 || c == 8) {
+            if (ed.pos > 0) editor_replace(&ed, ed.pos - 1, ed.pos, "", 0);
+        } else if (c == 4) {
+            if (ed.pos < ed.len) editor_replace(&ed, ed.pos, ed.pos + 1, "", 0);
+        } else if (c == 1) {
+            ed.pos = 0;
+        } else if (c == 5) {
+            ed.pos = ed.len;
+        } else if (c == 2) {
+            if (ed.pos > 0) ed.pos--;
+        } else if (c == 6) {
+            if (ed.pos < ed.len) ed.pos++;
+        } else if (c == 11) {
+            ed.len = ed.pos;
+            ed.buf[ed.len] = '\0';
+        } else if (c == 21) {
+            editor_replace(&ed, 0, ed.pos, "", 0);
+        } else if (c == 23) {
+            size_t from = ed.pos;
+            while (from > 0 && ed.buf[from - 1] == ' ') from--;
+            while (from > 0 && ed.buf[from - 1] != ' ') from--;
+            editor_replace(&ed, from, ed.pos, "", 0);
+        } else if (c == 12) {
+            sh_printf("\033[H\033[2J");
+        } else if (c == 16 || c == 14) {
+            editor_history(&ed, c == 16 ? -1 : 1);
+            redraw = 0;
+        } else if (c == 27) {
+            redraw = editor_escape(&ed);
+        } else if (c >= 32) {
+            char ch = c;
+            editor_replace(&ed, ed.pos, ed.pos, &ch, 1);
+        } else {
+            redraw = 0;
+        }
+        if (redraw) editor_refresh(&ed);
+    }
+    sh_flush();
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &editor_saved);
+
+    if (result > 0) {
+        if (*line_cap < (size_t)result + 1) {
+            *line_cap = result + 1;
+            *line = realloc(*line, *line_cap);
+        }
+        memcpy(*line, ed.buf, ed.len);
+        (*line)[ed.len] = '\n';
+        (*line)[ed.len + 1] = '\0';
+        result = ed.len + 1;
+    }
+    free(ed.buf);
+    free(ed.draft);
+    return result;
+}
+
+static const unsigned char word_delimiter[256] = {
+    ['\0'] = 1, [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\r'] = 1,
+    ['\\'] = 1, ['|'] = 1, ['<'] = 1, ['>'] = 1, ['&'] = 1,
+};
+
+int operator_kind(const char *arg) {
+    uintptr_t at = (uintptr_t)arg, first = (uintptr_t)operator_text[0];
+    if (at < first || at >= (uintptr_t)operator_text[OP_COUNT]) return OP_NONE;
+    return (at - first) / sizeof(operator_text[0]) + 1;
+}
+
+static int match_operator(const char *p, size_t *len) {
+    int op = OP_NONE;
+    if (p[0] == '2' && p[1] == '>') {
+        op = p[2] == '&' && p[3] == '1' ? OP_ERR_TO_OUT : p[2] == '>' ? OP_ERR_APPEND : OP_ERR;
+    } else if (p[0] == '|') {
+        op = OP_PIPE;
+    } else if (p[0] == '<') {
+        op = OP_IN;
+    } else if (p[0] == '>') {
+        op = p[1] == '>' ? OP_APPEND : OP_OUT;
+    } else if (p[0] == '&') {
+        op = p[1] == '>' ? OP_BOTH : OP_BACKGROUND;
+    }
+    if (op) *len = strlen(operator_text[op - 1]);
+    return op;
+}
+
+static char *word_scan(char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r'), nul = _mm_setzero_si128(), backslash = _mm_set1_epi8('\\');
+    const __m128i bar = _mm_set1_epi8('|'), less = _mm_set1_epi8('<'), greater = _mm_set1_epi8('>');
+    const __m128i amp = _mm_set1_epi8('&');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, cr)));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, nul), _mm_cmpeq_epi8(v, backslash)));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, bar), _mm_cmpeq_epi8(v, amp)));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, less), _mm_cmpeq_epi8(v, greater)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && !word_delimiter[(unsigned char)*p]) p++;
+    return p;
+}
+
+static void token_push(Tokens *tokens, char *token) {
+    if (tokens->count + 2 > tokens->cap) {
+        tokens->cap = tokens->cap ? tokens->cap * 2 : 16;
+        tokens->argv = realloc(tokens->argv, tokens->cap * sizeof(char *));
+    }
+    tokens->argv[tokens->count++] = token;
+    tokens->argv[tokens->count] = NULL;
+}
+
+int parse_input(char *line, size_t len, Tokens *tokens) {
+    char *p = line, *end = line + len;
+    tokens->count = 0;
+    token_push(tokens, NULL);
+    tokens->count = 0;
+
+    for (;;) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        if (p >= end || *p == '\0') break;
+
+        size_t op_len;
+        int op = match_operator(p, &op_len);
+        if (op) {
+            token_push(tokens, (char *)operator_text[op - 1]);
+            p += op_len;
+            continue;
+        }
+
+        char *start = p, *out = p;
+        if (*p == '\'' || *p == '"') {
+            char quote = *p++;
+            for (;;) {
+                if (p >= end || *p == '\0') {
+                    sh_printf("Unterminated %s quote\n", quote == '"' ? "double" : "single");
+                    return -1;
+                }
+                if (*p == quote) {
+                    p++;
+                    break;
+                }
+                if (quote == '"' && *p == '\\' && (p[1] == '"' || p[1] == '\\')) p++;
+                *out++ = *p++;
+            }
+        }
+        for (;;) {
+            char *stop = word_scan(p, end);
+            if (out != p) memmove(out, p, stop - p);
+            out += stop - p;
+            p = stop;
+            if (p >= end || *p != '\\') break;
+            p++;
+            if (p < end && *p != '\0' && *p != '\n') *out++ = *p++;
+        }
+
+        op = p < end && *p != '\0' ? match_operator(p, &op_len) : OP_NONE;
+        if (p < end && *p == '\0') end = p;
+        *out = '\0';
+        token_push(tokens, start);
+        if (op) {
+            token_push(tokens, (char *)operator_text[op - 1]);
+            p += op_len;
+        } else if (p < end) {
+            p++;
+        }
+    }
+    return 0;
+}
+
+static unsigned int command_hash(const char *name, unsigned int seed) {
+    unsigned int h = 2166136261u ^ seed;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static int rebuild_command_slots() {
+    for (unsigned int seed = 0; seed < 100000; seed++) {
+        memset(command_slots, 0, sizeof(command_slots));
+        int collided = 0;
+        for (int i = 0; i < command_count && !collided; i++) {
+            unsigned int slot = command_hash(commands[i]->name, seed) & (COMMAND_SLOTS - 1);
+            if (command_slots[slot]) {
+                collided = 1;
+            } else {
+                command_slots[slot] = commands[i];
+            }
+        }
+        if (!collided) {
+            command_seed = seed;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int register_command(const Command *cmd) {
+    if (command_count == MAX_COMMANDS || find_command(cmd->name)) {
+        fprintf(stderr, "register_command: cannot register '%s'\n", cmd->name);
+        return -1;
+    }
+    commands[command_count++] = cmd;
+    if (rebuild_command_slots()) {
+        command_count--;
+        rebuild_command_slots();
+        fprintf(stderr, "register_command: no perfect hash for '%s'\n", cmd->name);
+        return -1;
+    }
+    complete_add(&completer, cmd->name, COMPLETE_COMMAND);
+    return 0;
+}
+
+const Command *find_command(const char *name) {
+    const Command *cmd = command_slots[command_hash(name, command_seed) & (COMMAND_SLOTS - 1)];
+    if (cmd && strcmp(cmd->name, name) == 0) {
+        return cmd;
+    }
+    return NULL;
+}
+
+void init_commands() {
+    for (int i = 0; builtin_commands[i].name != NULL; i++) {
+        register_command(&builtin_commands[i]);
+    }
+}
+
+void execute_command(char **args) {
+    if (!args[0]) return;
+
+    const Command *cmd = find_command(args[0]);
+    if (cmd == NULL) {
+        sh_printf("Command not recognized. Type 'help' for options.\n");
+        return;
+    }
+
+    if ((cmd->flags & CMD_LOCAL_ONLY) && session->remote) {
+        sh_printf("'%s' is not available in server sessions.\n", cmd->name);
+        return;
+    }
+
+    int argc = 0;
+    while (args[argc + 1] != NULL) argc++;
+    if (argc < cmd->min_args || (cmd->max_args != ARGS_ANY && argc > cmd->max_args)) {
+        sh_printf("Usage: %s%s%s\n", cmd->name, cmd->usage ? " " : "", cmd->usage ? cmd->usage : "");
+        return;
+    }
+
+    if ((cmd->flags & CMD_JOURNAL) && session->journal != -1) {
+        journal_append(args);
+    }
+    if (session->recorder) {
+        recorder_command(args, cmd->name);
+    }
+    unsigned long long begin = now_ns();
+    cmd->handler(args);
+    int slot = command_slot(cmd);
+    if (slot >= 0) {
+        stat_record(slot, cmd->name, begin);
+    }
+    if ((cmd->flags & CMD_RESTORES) && session->recorder) {
+        recorder_restored();
+    }
+}
+
+static int is_redirect_token(const char *arg) {
+    int op = operator_kind(arg);
+    return op != OP_NONE && op != OP_PIPE && op != OP_BACKGROUND;
+}
+
+void run_command_line(char **args) {
+    int piped = 0;
+    for (int i = 0; args[i] != NULL; i++) {
+        int op = operator_kind(args[i]);
+        if (op == OP_BACKGROUND) {
+            if (i == 0 || args[i + 1] != NULL) {
+                sh_printf("Invalid background syntax; '&' must end the command.\n");
+                return;
+            }
+            if (session->remote) {
+                sh_printf("Background jobs are only available in the local shell.\n");
+                return;
+            }
+            args[i] = NULL;
+            start_job(args);
+            return;
+        }
+        if (op != OP_NONE) piped = 1;
+    }
+    if (piped) {
+        execute_with_pipe(args);
+    } else {
+        execute_command(args);
+    }
+}
+
+void cmd_investigate(char **args) {
+    (void)args;
+    handle_investigate();
+}
+
+void cmd_interview(char **args) {
+    char *name = join_args(args + 1);
+    handle_interview(name);
+    free(name);
+}
+
+void cmd_accuse(char **args) {
+    char *name = join_args(args + 1);
+    handle_accuse(name);
+    free(name);
+}
+
+void cmd_examine(char **args) {
+    char *name = join_args(args + 1);
+    handle_examine(name);
+    free(name);
+}
+
+void cmd_move(char **args) {
+    char *name = join_args(args + 1);
+    handle_move(name);
+    free(name);
+}
+
+void cmd_whereis(char **args) {
+    char *name = join_args(args + 1);
+    handle_whereis(name);
+    free(name);
+}
+
+void cmd_status(char **args) {
+    (void)args;
+    print_case_status();
+}
+
+static void draw_help() {
+    sh_printf("\n");
+    sh_styled(STYLE_HEADING, "COMMANDS:");
+    sh_printf("\n");
+    for (int i = 0; i < command_count; i++) {
+        const Command *cmd = commands[i];
+        if (cmd->help == NULL) continue;
+        if ((cmd->flags & CMD_LOCAL_ONLY) && session->remote) continue;
+        sh_printf("  %s%s%s - %s\n", cmd->name, cmd->usage ? " " : "", cmd->usage ? cmd->usage : "", cmd->help);
+    }
+    sh_printf("\n");
+    sh_styled(STYLE_HEADING, "REDIRECTION:");
+    sh_printf("\n");
+    sh_printf("  command > file - Redirect output to file\n");
+    sh_printf("  command >> file - Append output to file\n");
+    sh_printf("  command < file - Read input from file\n");
+    sh_printf("  command 2> file - Redirect errors to file\n");
+    sh_printf("  command &> file - Redirect output and errors to file\n");
+    sh_printf("  command1 | command2 | ... - Pipe output\n\n");
+}
+
+void cmd_help(char **args) {
+    (void)args;
+    show_screen(&help_screens[session->remote != 0], draw_help);
+}
+
+void cmd_ls(char **args) {
+    (void)args;
+    evidence_flush(&session->store);
+    if (tool_is_external("ls")) {
+        run_external_tool("ls", NULL);
+    } else {
+        native_ls(session->case_dir);
+    }
+}
+
+void cmd_cd(char **args) {
+    if (chdir(args[1])) {
+        sh_perror("cd failed");
+    }
+}
+
+void cmd_cat(char **args) {
+    if (tool_is_external("cat")) {
+        run_external_tool("cat", args[1]);
+    } else if (args[1]) {
+        char path[256];
+        if (case_file_path(path, sizeof(path), args[1])) return;
+        if (cached_case_file(args[1], 0) == 0) return;
+        native_cat(path);
+    } else {
+        native_cat(NULL);
+    }
+}
+
+void cmd_forkbomb(char **args) {
+    controlled_forkbomb(args[1] ? atoi(args[1]) : 10);
+}
+
+void cmd_mv(char **args) {
+    char from[256], to[256];
+    if (session_path(from, sizeof(from), args[1]) || session_path(to, sizeof(to), args[2])) {
+        return;
+    }
+    evidence_flush(&session->store);
+    if (rename(from, to) == 0) {
+        sh_printf("Moved %s to %s\n", args[1], args[2]);
+    } else {
+        sh_perror("mv failed");
+    }
+}
+
+void cmd_du(char **args) {
+    (void)args;
+    evidence_flush(&session->store);
+    if (tool_is_external("du")) {
+        run_external_tool("du", NULL);
+    } else {
+        native_du(session->case_dir);
+    }
+}
+
+void cmd_date(char **args) {
+    (void)args;
+    if (tool_is_external("date")) {
+        run_external_tool("date", NULL);
+    } else {
+        native_date();
+    }
+}
+
+void cmd_rev(char **args) {
+    if (tool_is_external("rev")) {
+        run_external_tool("rev", args[1]);
+    } else if (args[1]) {
+        char path[256];
+        if (case_file_path(path, sizeof(path), args[1])) return;
+        if (cached_case_file(args[1], 1) == 0) return;
+        native_rev(path);
+    } else {
+        native_rev(NULL);
+    }
+}
+
+void cmd_tool(char **args) {
+    handle_tool(args);
+}
+
+void cmd_execdemo(char **args) {
+    (void)args;
+    demonstrate_exec();
+}
+
+void cmd_waitdemo(char **args) {
+    (void)args;
+    demonstrate_waitpid();
+}
+
+void cmd_execvpdemo(char **args) {
+    (void)args;
+    demonstrate_execvp();
+}
+
+void cmd_exit(char **args) {
+    (void)args;
+    sh_printf("\nCase abandoned. The streets remain unsafe...\n");
+    session->outcome = CASE_ABANDONED;
+    session->running = 0;
+}
+
+static ssize_t ring_read(void *cookie, char *buf, size_t size) {
+    RingBuffer *ring = cookie;
+    pthread_mutex_lock(&ring->lock);
+    while (ring->head == ring->tail && !ring->writer_closed) {
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    }
+    size_t n = 0;
+    while (n < size && ring->head != ring->tail) {
+        size_t off = ring->head % RING_SIZE;
+        size_t run = RING_SIZE - off;
+        if (run > ring->tail - ring->head) run = ring->tail - ring->head;
+        if (run > size - n) run = size - n;
+        memcpy(buf + n, ring->data + off, run);
+        ring->head += run;
+        n += run;
+    }
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+    return n;
+}
+
+static ssize_t ring_write(void *cookie, const char *buf, size_t size) {
+    RingBuffer *ring = cookie;
+    size_t n = 0;
+    pthread_mutex_lock(&ring->lock);
+    while (n < size) {
+        while (ring->tail - ring->head == RING_SIZE && !ring->reader_closed) {
+            pthread_cond_wait(&ring->cond, &ring->lock);
+        }
+        if (ring->reader_closed) {
+            pthread_mutex_unlock(&ring->lock);
+            errno = EPIPE;
+            return n > 0 ? (ssize_t)n : -1;
+        }
+        size_t off = ring->tail % RING_SIZE;
+        size_t run = RING_SIZE - off;
+        size_t space = RING_SIZE - (ring->tail - ring->head);
+        if (run > space) run = space;
+        if (run > size - n) run = size - n;
+        memcpy(ring->data + off, buf + n, run);
+        ring->tail += run;
+        n += run;
+        pthread_cond_broadcast(&ring->cond);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return n;
+}
+
+static int ring_close(void *cookie, int reader) {
+    RingBuffer *ring = cookie;
+    pthread_mutex_lock(&ring->lock);
+    if (reader) {
+        ring->reader_closed = 1;
+    } else {
+        ring->writer_closed = 1;
+    }
+    int refs = --ring->refs;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+    if (refs == 0) {
+        pthread_mutex_destroy(&ring->lock);
+        pthread_cond_destroy(&ring->cond);
+        free(ring);
+    }
+    return 0;
+}
+
+static int ring_close_reader(void *cookie) {
+    return ring_close(cookie, 1);
+}
+
+static int ring_close_writer(void *cookie) {
+    return ring_close(cookie, 0);
+}
+
+FILE *ring_open(RingBuffer *ring, const char *mode) {
+    cookie_io_functions_t io = {0};
+    if (mode[0] == 'r') {
+        io.read = ring_read;
+        io.close = ring_close_reader;
+    } else {
+        io.write = ring_write;
+        io.close = ring_close_writer;
+    }
+    return fopencookie(ring, mode, io);
+}
+
+static RingBuffer *ring_new() {
+    RingBuffer *ring = calloc(1, sizeof(RingBuffer));
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    ring->refs = 2;
+    return ring;
+}
+
+static void close_stage_streams(Stage *stage) {
+    if (stage->err && stage->owns_err) fclose(stage->err);
+    if (stage->in && stage->owns_in) fclose(stage->in);
+    if (stage->out && stage->owns_out) fclose(stage->out);
+    if (stage->in_fd >= 0) close(stage->in_fd);
+    if (stage->out_fd >= 0) close(stage->out_fd);
+    if (stage->spill_fd >= 0) close(stage->spill_fd);
+    stage->in = stage->out = stage->err = NULL;
+    stage->in_fd = stage->out_fd = stage->spill_fd = -1;
+}
+
+static void *stage_thread(void *arg) {
+    Stage *stage = arg;
+    session = stage->session;
+    sh_in = stage->in;
+    sh_out = stage->out;
+    sh_err = stage->err;
+    execute_command(stage->argv);
+    sh_flush();
+    close_stage_streams(stage);
+    return NULL;
+}
+
+static void run_stage_here(Stage *stage) {
+    FILE *saved_in = sh_in, *saved_out = sh_out, *saved_err = sh_err;
+    stage_thread(stage);
+    sh_in = saved_in;
+    sh_out = saved_out;
+    sh_err = saved_err;
+}
+
+static int parse_redirections(Stage *stage) {
+    char **argv = stage->argv;
+    int kept = 0;
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (!is_redirect_token(argv[i])) {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        int op = operator_kind(argv[i]);
+        if (op == OP_ERR_TO_OUT) {
+            stage->err_to_out = 1;
+            continue;
+        }
+        char *target = argv[i + 1];
+        if (target == NULL || operator_kind(target) != OP_NONE) {
+            return -1;
+        }
+        i++;
+        if (op == OP_IN) {
+            stage->in_file = target;
+        } else if (op == OP_OUT || op == OP_APPEND) {
+            stage->out_file = target;
+            stage->out_append = op == OP_APPEND;
+        } else if (op == OP_ERR || op == OP_ERR_APPEND) {
+            stage->err_file = target;
+            stage->err_append = op == OP_ERR_APPEND;
+            stage->err_to_out = 0;
+        } else {
+            stage->out_file = target;
+            stage->out_append = 0;
+            stage->err_to_out = 1;
+        }
+    }
+    argv[kept] = NULL;
+    return kept > 0 ? 0 : -1;
+}
+
+static FILE *open_redirect(const char *name, const char *mode) {
+    char path[256];
+    if (session_path(path, sizeof(path), name)) return NULL;
+    evidence_flush(&session->store);
+    int flags = mode[0] == 'r' ? O_RDONLY : O_WRONLY | O_CREAT | (mode[0] == 'a' ? O_APPEND : O_TRUNC);
+    int fd = flags & O_CREAT ? open(path, flags | O_EXCL | O_CLOEXEC, 0644) : -1;
+    if (fd >= 0) {
+        STAT_ADD(files_created, 1);
+    } else {
+        fd = open(path, flags | O_CLOEXEC, 0644);
+    }
+    if (fd == -1) {
+        fprintf(sh_err, "%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    return fdopen(fd, mode);
+}
+
+int handle_redirection(Stage *stage) {
+    if (stage->in_file) {
+        FILE *in = open_redirect(stage->in_file, "r");
+        if (in == NULL) return -1;
+        if (stage->in && stage->owns_in) fclose(stage->in);
+        if (stage->in_fd >= 0) close(stage->in_fd);
+        stage->in_fd = -1;
+        stage->in = in;
+        stage->owns_in = 1;
+    }
+    if (stage->out_file) {
+        FILE *out = open_redirect(stage->out_file, stage->out_append ? "a" : "w");
+        if (out == NULL) return -1;
+        if (stage->out && stage->owns_out) fclose(stage->out);
+        if (stage->out_fd >= 0) close(stage->out_fd);
+        stage->out_fd = -1;
+        stage->out = out;
+        stage->owns_out = 1;
+    }
+    if (stage->err_to_out) {
+        if (stage->out == NULL) {
+            stage->out = fdopen(stage->out_fd, "w");
+            stage->out_fd = -1;
+            stage->owns_out = 1;
+        }
+        stage->err = stage->out;
+        stage->owns_err = 0;
+    } else if (stage->err_file) {
+        FILE *err = open_redirect(stage->err_file, stage->err_append ? "a" : "w");
+        if (err == NULL) return -1;
+        stage->err = err;
+        stage->owns_err = 1;
+    }
+    return 0;
+}
+
+static int stage_fd(FILE *stream, int fd) {
+    if (stream == NULL) return fd;
+    return stream_fd(stream);
+}
+
+static void *job_stage_thread(void *arg) {
+    Stage *stage = arg;
+    uint64_t one = 1;
+    stage_thread(stage);
+    __atomic_store_n(&stage->finished, 1, __ATOMIC_RELEASE);
+    return write(job_wake_fd, &one, sizeof(one)) == sizeof(one) ? stage : NULL;
+}
+
+static int tool_known(const char *name) {
+    for (int i = 0; tool_modes[i].name != NULL; i++) {
+        if (strcmp(tool_modes[i].name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Game and journal builtins share the session, so only the tools may run on threads. */
+static int stage_stateful(const Stage *stage) {
+    return stage->builtin && !tool_known(stage->builtin->name);
+}
+
+static int pipeline_stages(char **args) {
+    int count = 1;
+    for (int i = 0; args[i] != NULL; i++) {
+        if (operator_kind(args[i]) == OP_PIPE) count++;
+    }
+    return count;
+}
+
+static int run_pipeline(char **args, char **argv_store, Stage *stages, Job *job) {
+    int count = 0;
+    int argc = 0;
+
+    for (int i = 0; ; i++) {
+        if (args[i] == NULL || operator_kind(args[i]) == OP_PIPE) {
+            if (argc == 0) {
+                sh_printf("Invalid pipe syntax\n");
+                return -1;
+            }
+            argv_store[i] = NULL;
+            stages[count].argv = &argv_store[i - argc];
+            if (parse_redirections(&stages[count])) {
+                sh_printf("Invalid redirection syntax\n");
+                return -1;
+            }
+            count++;
+            argc = 0;
+            if (args[i] == NULL) break;
+            continue;
+        }
+        argv_store[i] = args[i];
+        argc++;
+    }
+
+    for (int i = 0; i < count; i++) {
+        Stage *stage = &stages[i];
+        stage->builtin = find_command(stage->argv[0]);
+        stage->in_fd = stage->out_fd = stage->spill_fd = -1;
+        stage->pid = -1;
+        stage->err = sh_err;
+        stage->session = session;
+        if (stage->builtin && strcmp(stage->argv[0], "examine") != 0 && tool_is_external(stage->argv[0])) {
+            if (external_tool_argv(stage->argv[0], stage->argv[1], stage->tool_argv, stage->tool_path, sizeof(stage->tool_path)) < 0) {
+                return -1;
+            }
+            stage->argv = stage->tool_argv;
+            stage->builtin = NULL;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (stages[i].builtin || stages[i].argv == stages[i].tool_argv) continue;
+        if ((count == 1 && job == NULL) || session->remote) {
+            sh_printf("Command not recognized. Type 'help' for options.\n");
+            return -1;
+        }
+    }
+    for (int i = 0; job && i < count; i++) {
+        if (stage_stateful(&stages[i])) {
+            sh_printf("'%s' cannot run in the background.\n", stages[i].builtin->name);
+            return -1;
+        }
+    }
+
+    stages[0].in = sh_in;
+    if (job && !job_control && stages[0].in_file == NULL) {
+        if (stages[0].builtin) {
+            stages[0].in = fopen("/dev/null", "r");
+            stages[0].owns_in = stages[0].in != NULL;
+        } else {
+            stages[0].in = NULL;
+            stages[0].in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+    }
+    stages[count - 1].out = sh_out;
+    for (int i = 0; i + 1 < count; i++) {
+        Stage *left = &stages[i], *right = &stages[i + 1];
+        if (stage_stateful(right)) {
+            /* game commands never read their input */
+            if (left->builtin) {
+                left->out = fopen("/dev/null", "w");
+                left->owns_out = left->out != NULL;
+            } else {
+                left->out_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+            }
+            continue;
+        }
+        if (stage_stateful(left)) {
+            left->spill_fd = memfd_create("stage", MFD_CLOEXEC);
+            left->out = left->spill_fd >= 0 ? fdopen(dup(left->spill_fd), "w") : NULL;
+            if (left->out == NULL) {
+                sh_perror("pipe failed");
+                for (int j = 0; j < count; j++) close_stage_streams(&stages[j]);
+                return -1;
+            }
+            left->owns_out = 1;
+            continue;
+        }
+        if (left->builtin && right->builtin) {
+            RingBuffer *ring = ring_new();
+            left->out = ring_open(ring, "w");
+            right->in = ring_open(ring, "r");
+            left->owns_out = right->owns_in = 1;
+            continue;
+        }
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC)) {
+            sh_perror("pipe failed");
+            for (int j = 0; j < count; j++) close_stage_streams(&stages[j]);
+            return -1;
+        }
+        if (left->builtin) {
+            left->out = fdopen(fds[1], "w");
+            left->owns_out = 1;
+        } else {
+            left->out_fd = fds[1];
+        }
+        if (right->builtin) {
+            right->in = fdopen(fds[0], "r");
+            right->owns_in = 1;
+        } else {
+            right->in_fd = fds[0];
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        unsigned long long begin = now_ns();
+        int failed = handle_redirection(&stages[i]);
+        stat_record(STAT_REDIRECT, "redirect", begin);
+        if (failed) {
+            for (int j = 0; j < count; j++) close_stage_streams(&stages[j]);
+            return -1;
+        }
+    }
+
+    Stage *last = &stages[count - 1];
+    int relay = -1;
+    if (!last->builtin && stage_fd(last->out, last->out_fd) < 0) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC)) {
+            sh_perror("pipe failed");
+            for (int j = 0; j < count; j++) close_stage_streams(&stages[j]);
+            return -1;
+        }
+        if (last->owns_out) fclose(last->out);
+        last->out = NULL;
+        last->out_fd = fds[1];
+        relay = fds[0];
+    }
+
+    sh_flush();
+    for (int i = 0; i + 1 < count; i++) {
+        Stage *stage = &stages[i], *right = &stages[i + 1];
+        if (!stage_stateful(stage)) continue;
+        int spill = stage->spill_fd;
+        stage->spill_fd = -1;
+        run_stage_here(stage);
+        if (spill < 0) continue;
+        lseek(spill, 0, SEEK_SET);
+        if (right->in != NULL || right->in_fd >= 0) {
+            close(spill);
+        } else if (right->builtin) {
+            right->in = fdopen(spill, "r");
+            right->owns_in = 1;
+        } else {
+            right->in_fd = spill;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        Stage *stage = &stages[i];
+        if (stage->builtin) continue;
+        int out = stage_fd(stage->out, stage->out_fd);
+        int err = stage_fd(stage->err, -1);
+        if (job) {
+            LaunchRequest req = {.argv = stage->argv, .in_fd = stage_fd(stage->in, stage->in_fd), .out_fd = out,
+                                 .err_fd = err < 0 ? out : err, .grouped = 1, .pgid = job->pgid};
+            stage->pid = spawn_request(&req);
+            if (stage->pid > 0) {
+                if (job->pgid == 0) job->pgid = stage->pid;
+                job->last_pid = stage->pid;
+            } else if (stage == last) {
+                job->status = 127 << 8;
+            }
+        } else {
+            stage->pid = spawn_process(stage->argv, stage_fd(stage->in, stage->in_fd), out, err < 0 ? out : err);
+        }
+        close_stage_streams(stage);
+    }
+
+    if (job) {
+        job->count = count;
+        for (int i = 0; i < count; i++) {
+            if (!stages[i].builtin) continue;
+            if (pthread_create(&stages[i].thread, NULL, job_stage_thread, &stages[i]) == 0) {
+                stages[i].threaded = 1;
+            } else {
+                stage_thread(&stages[i]);
+            }
+        }
+        return 0;
+    }
+
+    for (int i = 0; i + 1 < count; i++) {
+        if (!stages[i].builtin || stage_stateful(&stages[i])) continue;
+        if (pthread_create(&stages[i].thread, NULL, stage_thread, &stages[i]) == 0) {
+            stages[i].threaded = 1;
+        } else {
+            stage_thread(&stages[i]);
+        }
+    }
+
+    if (relay >= 0) {
+        char buf[65536];
+        ssize_t n;
+        while ((n = read_chunk(relay, NULL, buf, sizeof(buf))) > 0) {
+            fwrite(buf, 1, n, sh_out);
+        }
+        close(relay);
+    }
+
+    if (last->builtin) {
+        run_stage_here(last);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (stages[i].threaded) {
+            pthread_join(stages[i].thread, NULL);
+        }
+        if (stages[i].pid > 0) {
+            unsigned long long begin = now_ns();
+            waitpid(stages[i].pid, NULL, 0);
+            stat_record(STAT_WAIT, "wait", begin);
+        }
+    }
+    return 0;
+}
+
+void execute_with_pipe(char **args) {
+    unsigned long long begin = now_ns();
+    int argc = 0;
+    while (args[argc] != NULL) argc++;
+    char **argv_store = malloc((argc + 1) * sizeof(char *));
+    Stage *stages = calloc(pipeline_stages(args), sizeof(Stage));
+    run_pipeline(args, argv_store, stages, NULL);
+    free(stages);
+    free(argv_store);
+    stat_record(STAT_PIPELINE, "pipeline", begin);
+}
+
+void jobs_init() {
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &chld, &launch_mask);
+    job_signal_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    job_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    job_control = !batch_mode && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+    if (job_control) {
+        shell_pgid = getpgrp();
+        signal(SIGTTOU, SIG_IGN);
+        setvbuf(stdin, NULL, _IONBF, 0);
+    }
+}
+
+static void drain_job_events() {
+    struct signalfd_siginfo info[16];
+    uint64_t wakes;
+    if (job_signal_fd >= 0) {
+        while (read(job_signal_fd, info, sizeof(info)) > 0) {}
+    }
+    if (job_wake_fd >= 0) {
+        while (read(job_wake_fd, &wakes, sizeof(wakes)) > 0) {}
+    }
+}
+
+static void wait_job_event() {
+    struct pollfd fds[2] = {{job_signal_fd, POLLIN, 0}, {job_wake_fd, POLLIN, 0}};
+    poll(fds, 2, job_signal_fd < 0 ? 50 : -1);
+    drain_job_events();
+}
+
+static void job_update(Job *job) {
+    int live = 0, stopped = 0;
+    for (int i = 0; i < job->count; i++) {
+        Stage *stage = &job->stages[i];
+        if (stage->pid > 0) {
+            int status;
+            pid_t got = waitpid(stage->pid, &status, WNOHANG | WUNTRACED | WCONTINUED);
+            if (got == stage->pid && WIFSTOPPED(status)) {
+                stage->stopped = 1;
+            } else if (got == stage->pid && WIFCONTINUED(status)) {
+                stage->stopped = 0;
+            } else if (got == stage->pid || (got < 0 && errno == ECHILD)) {
+                if (got == stage->pid && i == job->count - 1) job->status = status;
+                stage->pid = 0;
+            }
+        }
+        if (stage->threaded && __atomic_load_n(&stage->finished, __ATOMIC_ACQUIRE)) {
+            pthread_join(stage->thread, NULL);
+            stage->threaded = 0;
+        }
+        live += stage->pid > 0 || stage->threaded;
+        stopped += stage->pid > 0 && stage->stopped;
+    }
+    job->state = live == 0 ? JOB_DONE : stopped ? JOB_STOPPED : JOB_RUNNING;
+}
+
+void wait_for_input() {
+    sh_flush();
+    for (;;) {
+        struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {job_signal_fd, POLLIN, 0}, {job_wake_fd, POLLIN, 0}};
+        if (poll(fds, 3, -1) < 0 && errno != EINTR) return;
+        if (fds[0].revents) return;
+        drain_job_events();
+        for (Job *job = job_list; job != NULL; job = job->next) {
+            job_update(job);
+        }
+    }
+}
+
+static const char *job_state_text(const Job *job, char *buf, size_t size) {
+    if (job->state == JOB_RUNNING) return "Running";
+    if (job->state == JOB_STOPPED) return "Stopped";
+    if (WIFSIGNALED(job->status)) return strsignal(WTERMSIG(job->status));
+    if (WEXITSTATUS(job->status) == 0) return "Done";
+    snprintf(buf, size, "Exit %d", WEXITSTATUS(job->status));
+    return buf;
+}
+
+static void print_job(const Job *job) {
+    char buf[32];
+    char mark = ' ';
+    if (job->next == NULL) {
+        mark = '+';
+    } else if (job->next->next == NULL) {
+        mark = '-';
+    }
+    sh_printf("[%d]%c %-24s %s%s\n", job->id, mark, job_state_text(job, buf, sizeof(buf)), job->command,
+              job->state == JOB_RUNNING ? " &" : "");
+}
+
+static void job_free(Job *job) {
+    for (int i = 0; job->args && job->args[i] != NULL; i++) {
+        if (operator_kind(job->args[i]) == OP_NONE) free(job->args[i]);
+    }
+    free(job->args);
+    free(job->argv);
+    free(job->stages);
+    free(job->command);
+    free(job);
+}
+
+static void job_remove(Job *job) {
+    for (Job **link = &job_list; *link != NULL; link = &(*link)->next) {
+        if (*link == job) {
+            *link = job->next;
+            break;
+        }
+    }
+    job_free(job);
+}
+
+static void job_make_current(Job *job) {
+    Job **link = &job_list;
+    while (*link != job) link = &(*link)->next;
+    *link = job->next;
+    job->next = NULL;
+    while (*link != NULL) link = &(*link)->next;
+    *link = job;
+}
+
+void start_job(char **args) {
+    Job *job = calloc(1, sizeof(Job));
+    int argc = 0;
+    size_t len = 1;
+    while (args[argc] != NULL) len += strlen(args[argc++]) + 1;
+
+    job->stages = calloc(pipeline_stages(args), sizeof(Stage));
+    job->args = calloc(argc + 1, sizeof(char *));
+    job->argv = calloc(argc + 1, sizeof(char *));
+    job->command = malloc(len);
+    job->command[0] = '\0';
+    for (int i = 0; i < argc; i++) {
+        job->args[i] = operator_kind(args[i]) != OP_NONE ? args[i] : strdup(args[i]);
+        if (i > 0) strcat(job->command, " ");
+        strcat(job->command, args[i]);
+    }
+
+    unsigned long long begin = now_ns();
+    int failed = run_pipeline(job->args, job->argv, job->stages, job);
+    stat_record(STAT_PIPELINE, "pipeline", begin);
+    if (failed) {
+        job_free(job);
+        return;
+    }
+
+    Job **link = &job_list;
+    job->id = 1;
+    while (*link != NULL) {
+        if ((*link)->id >= job->id) job->id = (*link)->id + 1;
+        link = &(*link)->next;
+    }
+    *link = job;
+    if (job->last_pid > 0) {
+        sh_printf("[%d] %d\n", job->id, (int)job->last_pid);
+    } else {
+        sh_printf("[%d]\n", job->id);
+    }
+}
+
+void report_jobs() {
+    drain_job_events();
+    for (Job *job = job_list, *next; job != NULL; job = next) {
+        next = job->next;
+        job_update(job);
+        if (job->state == job->shown) continue;
+        job->shown = job->state;
+        print_job(job);
+    }
+}
+
+void jobs_shutdown() {
+    for (Job *job = job_list; job != NULL; job = job->next) {
+        job_update(job);
+        if (job->state == JOB_STOPPED && job->pgid > 0) {
+            kill(-job->pgid, SIGHUP);
+            kill(-job->pgid, SIGCONT);
+        }
+    }
+}
+
+static Job *find_job(char **args) {
+    const char *spec = args[1];
+    Job *job = job_list;
+    if (spec == NULL) {
+        while (job != NULL && job->next != NULL) job = job->next;
+        if (job == NULL) sh_printf("%s: no current job\n", args[0]);
+        return job;
+    }
+    if (*spec == '%') spec++;
+    char *end;
+    long id = strtol(spec, &end, 10);
+    while (job != NULL && (*end != '\0' || job->id != id)) job = job->next;
+    if (job == NULL) sh_printf("%s: %s: no such job\n", args[0], args[1]);
+    return job;
+}
+
+static void wait_job(Job *job) {
+    for (;;) {
+        job_update(job);
+        if (job->state != JOB_RUNNING) return;
+        wait_job_event();
+    }
+}
+
+static void resume_job(Job *job) {
+    if (job->state == JOB_STOPPED && job->pgid > 0) {
+        kill(-job->pgid, SIGCONT);
+    }
+    for (int i = 0; i < job->count; i++) {
+        job->stages[i].stopped = 0;
+    }
+    if (job->state == JOB_STOPPED) job->state = JOB_RUNNING;
+}
+
+void cmd_jobs(char **args) {
+    (void)args;
+    report_jobs();
+    for (Job *job = job_list, *next; job != NULL; job = next) {
+        next = job->next;
+        if (job->shown != job->state) {
+            job->shown = job->state;
+            print_job(job);
+        } else if (job->state != JOB_DONE) {
+            print_job(job);
+        }
+        if (job->state == JOB_DONE) job_remove(job);
+    }
+}
+
+void cmd_fg(char **args) {
+    Job *job = find_job(args);
+    if (job == NULL) return;
+    sh_printf("%s\n", job->command);
+    sh_flush();
+    if (job_control && job->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+    resume_job(job);
+    wait_job(job);
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+    if (job->state == JOB_STOPPED) {
+        job_make_current(job);
+        job->shown = JOB_STOPPED;
+        sh_printf("\n");
+        print_job(job);
+        return;
+    }
+    if (WIFSIGNALED(job->status)) {
+        sh_printf("%s\n", strsignal(WTERMSIG(job->status)));
+    }
+    job_remove(job);
+}
+
+void cmd_bg(char **args) {
+    Job *job = find_job(args);
+    if (job == NULL) return;
+    if (job->state != JOB_STOPPED) {
+        sh_printf("bg: job %d is already %s\n", job->id, job->state == JOB_DONE ? "done" : "running in the background");
+        return;
+    }
+    resume_job(job);
+    job_make_current(job);
+    job->shown = JOB_RUNNING;
+    print_job(job);
+}
+
+void cmd_wait(char **args) {
+    Job *target = args[1] ? find_job(args) : NULL;
+    if (args[1] && target == NULL) return;
+    for (Job *job = job_list, *next; job != NULL; job = next) {
+        next = job->next;
+        if (target && job != target) continue;
+        wait_job(job);
+        if (job->state == JOB_STOPPED) {
+            sh_printf("wait: job %d is stopped\n", job->id);
+            continue;
+        }
+        if (job->shown != JOB_DONE || target) print_job(job);
+        job_remove(job);
+    }
+}
+
+void demonstrate_exec() {
+    char *argv[] = {"ls", "case_files", NULL};
+    sh_printf("\nDemonstrating exec() system call:\n");
+    sh_printf("Child process will now execute 'ls case_files'\n");
+    if (run_external(argv) != -1) {
+        sh_printf("Parent process continuing\n\n");
+    }
+}
+
+void demonstrate_waitpid() {
+    sh_printf("\nDemonstrating waitpid() system call:\n");
+    sh_flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        sh_printf("Child process working...\n");
+        sh_flush();
+        sleep(2);
+        sh_printf("Child process done\n");
+        exit(42);
+    } else if (pid > 0) {
+        int status;
+        waitpid(pid, &status, 0);
+        if (WIFEXITED(status)) {
+            sh_printf("Child exited with status: %d\n\n", WEXITSTATUS(status));
+        }
+    } else {
+        perror("fork failed");
+    }
+}
+
+void demonstrate_execvp() {
+    char *argv[] = {"ls", "-l", "case_files", NULL};
+    sh_printf("\nDemonstrating execvp() system call:\n");
+    sh_printf("Child will now execute 'ls -l case_files'\n");
+    if (run_external(argv) != -1) {
+        sh_printf("Parent process continuing\n\n");
+    }
+}
+
+static long read_long_file(const char *path) {
+    char buf[64];
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return -1;
+    long value = -1;
+    if (fgets(buf, sizeof(buf), fp) && strncmp(buf, "max", 3) != 0) {
+        value = atol(buf);
+    }
+    fclose(fp);
+    return value;
+}
+
+static long cgroup_pids_left() {
+    char line[512], path[768];
+    long left = -1;
+    FILE *fp = fopen("/proc/self/cgroup", "r");
+    if (fp == NULL) return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *controllers = strchr(line, ':');
+        char *cgroup = controllers ? strchr(controllers + 1, ':') : NULL;
+        if (cgroup == NULL) continue;
+        *cgroup++ = '\0';
+        controllers++;
+
+        if (controllers[0] == '\0') {
+            snprintf(path, sizeof(path), "/sys/fs/cgroup%s/pids.max", cgroup);
+        } else if (strstr(controllers, "pids")) {
+            snprintf(path, sizeof(path), "/sys/fs/cgroup/pids%s/pids.max", cgroup);
+        } else {
+            continue;
+        }
+        long max = read_long_file(path);
+        strcpy(strrchr(path, '/'), "/pids.current");
+        long current = read_long_file(path);
+        if (max > 0 && current >= 0 && (left < 0 || max - current < left)) {
+            left = max - current;
+        }
+    }
+    fclose(fp);
+    return left;
+}
+
+static long user_processes() {
+    DIR *d = opendir("/proc");
+    if (d == NULL) return 0;
+    long count = 0;
+    uid_t uid = getuid();
+    struct dirent *entry;
+    struct stat st;
+    char path[300];
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+        snprintf(path, sizeof(path), "/proc/%s", entry->d_name);
+        if (stat(path, &st) == 0 && st.st_uid == uid) count++;
+    }
+    closedir(d);
+    return count;
+}
+
+int process_cap() {
+    long cap = PROCESS_CAP_MAX;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NPROC, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        long left = (long)rl.rlim_cur - user_processes();
+        if (left < cap) cap = left;
+    }
+    long pids = cgroup_pids_left();
+    if (pids >= 0 && pids < cap) cap = pids;
+
+    cap -= PROCESS_CAP_MARGIN;
+    return cap < 1 ? 1 : (int)cap;
+}
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static pid_t launch_with_real_vfork(LaunchRequest *req) {
+    pid_t pid = vfork();
+    if (pid == 0) {
+        execvp(req->argv[0], req->argv);
+        _exit(127);
+    }
+    if (pid < 0) {
+        sh_perror("vfork failed");
+    }
+    return pid;
+}
+
+typedef struct {
+    const char *name;
+    pid_t (*launch)(LaunchRequest *req);
+} SpawnMethod;
+
+const SpawnMethod spawn_methods[] = {
+    {"fork", launch_with_fork},
+    {"vfork", launch_with_real_vfork},
+    {"posix_spawn", launch_with_spawn},
+    {"clone", launch_with_vfork},
+    {NULL, NULL}
+};
+
+static int compare_ns(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(unsigned long long *samples, int count, int pct) {
+    int idx = (int)((long)count * pct / 100);
+    if (idx >= count) idx = count - 1;
+    return samples[idx] / 1000.0;
+}
+
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int bench_method(const SpawnMethod *method, int total, int concurrency) {
+    char *argv[] = {"true", NULL};
+    LaunchRequest req = {.argv = argv, .in_fd = -1, .out_fd = -1, .err_fd = -1};
+    pid_t *pids = malloc(concurrency * sizeof(pid_t));
+    struct pollfd *fds = malloc(concurrency * sizeof(struct pollfd));
+    unsigned long long *started = malloc(concurrency * sizeof(unsigned long long));
+    unsigned long long *spawn_lat = malloc(total * sizeof(unsigned long long));
+    unsigned long long *exit_lat = malloc(total * sizeof(unsigned long long));
+    int launched = 0, reaped = 0, running = 0, failed = 0;
+    int pidfds = 1;
+
+    sh_flush();
+    unsigned long long begin = now_ns();
+    while (reaped < launched || (launched < total && !failed)) {
+        while (running < concurrency && launched < total && !failed) {
+            unsigned long long t0 = now_ns();
+            pid_t pid = method->launch(&req);
+            unsigned long long t1 = now_ns();
+            if (pid <= 0) {
+                failed = 1;
+                break;
+            }
+            pids[running] = pid;
+            started[running] = t0;
+            fds[running].fd = pidfds ? open_pidfd(pid) : -1;
+            fds[running].events = POLLIN;
+            fds[running].revents = 0;
+            if (fds[running].fd < 0 && pidfds) {
+                /* without pidfds for every child, reap them one waitpid at a time */
+                for (int i = 0; i < running; i++) {
+                    close(fds[i].fd);
+                    fds[i].fd = -1;
+                }
+                pidfds = 0;
+            }
+            spawn_lat[launched++] = t1 - t0;
+            running++;
+        }
+        if (running == 0) break;
+
+        int ready = -1;
+        if (pidfds) {
+            while (poll(fds, running, -1) < 0 && errno == EINTR);
+        }
+        for (int i = 0; i < running; i++) {
+            if (pidfds && !(fds[i].revents & POLLIN)) continue;
+            if (!pidfds && ready >= 0) continue;
+            waitpid(pids[i], NULL, 0);
+            exit_lat[reaped++] = now_ns() - started[i];
+            if (fds[i].fd >= 0) close(fds[i].fd);
+            running--;
+            pids[i] = pids[running];
+            started[i] = started[running];
+            fds[i] = fds[running];
+            ready = i--;
+        }
+    }
+    unsigned long long elapsed = now_ns() - begin;
+
+    if (reaped > 0) {
+        qsort(spawn_lat, reaped, sizeof(unsigned long long), compare_ns);
+        qsort(exit_lat, reaped, sizeof(unsigned long long), compare_ns);
+        sh_printf("  %-12s %8d %12.0f %10.1f %10.1f %10.1f %10.1f\n", method->name, reaped,
+                  reaped / (elapsed / 1e9),
+                  percentile_us(spawn_lat, reaped, 50), percentile_us(spawn_lat, reaped, 99),
+                  percentile_us(exit_lat, reaped, 50), percentile_us(exit_lat, reaped, 99));
+    }
+
+    free(pids);
+    free(fds);
+    free(started);
+    free(spawn_lat);
+    free(exit_lat);
+    return failed ? -1 : 0;
+}
+
+void run_spawnbench(int total, int concurrency, const char *only) {
+    int cap = process_cap();
+    if (total < 1) total = 1;
+    if (concurrency < 1) concurrency = 1;
+    if (concurrency > cap) {
+        sh_printf("Concurrency capped at %d by process limits\n", cap);
+        concurrency = cap;
+    }
+
+    if (only && strcmp(only, "all") == 0) only = NULL;
+    int matched = only == NULL;
+    for (int i = 0; spawn_methods[i].name != NULL && !matched; i++) {
+        matched = strcmp(only, spawn_methods[i].name) == 0;
+    }
+    if (!matched) {
+        sh_printf("No method by that name. Try: fork, vfork, posix_spawn, clone, all\n");
+        return;
+    }
+
+    sh_printf("\n");
+    sh_styled(STYLE_HEADING, "SPAWN BENCHMARK:");
+    sh_printf(" %d processes, %d at a time (/bin/true)\n", total, concurrency);
+    sh_printf("  %-12s %8s %12s %10s %10s %10s %10s\n", "method", "spawns", "spawns/sec",
+              "call p50", "call p99", "exit p50", "exit p99");
+    for (int i = 0; spawn_methods[i].name != NULL; i++) {
+        if (only && strcmp(only, spawn_methods[i].name) != 0) continue;
+        if (bench_method(&spawn_methods[i], total, concurrency)) {
+            sh_printf("  %-12s stopped early: process creation failed\n", spawn_methods[i].name);
+        }
+    }
+    sh_printf("  (latencies in microseconds: call = time inside the spawn call, exit = spawn until reaped)\n\n");
+}
+
+void cmd_spawnbench(char **args) {
+    int total = args[1] ? atoi(args[1]) : 1000;
+    int concurrency = (args[1] && args[2]) ? atoi(args[2]) : 1;
+    run_spawnbench(total, concurrency, (args[1] && args[2]) ? args[3] : NULL);
+}
+
+static int write_stream_dump(const char *path, long long size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) return -1;
+    char buf[STREAM_CHUNK];
+    size_t used = 0;
+    unsigned int seed = 12345;
+    for (long long line = 0, written = 0; written < size; line++) {
+        int len = 16 + (seed = seed * 1103515245 + 12345) % 185;
+        if (line % 997 == 0) len = 10000;
+        if (line == 4096) len = 3 << 20;
+        if (len > size - written) len = size - written;
+        for (int i = 0; i < len; i++) {
+            if (used == sizeof(buf)) {
+                if (write_all(fd, buf, used)) {
+                    close(fd);
+                    return -1;
+                }
+                used = 0;
+            }
+            buf[used++] = i + 1 == len ? '\n' : "0123456789abcdef ROOM-ledger"[(line + i * 7) % 28];
+        }
+        written += len;
+    }
+    int status = write_all(fd, buf, used);
+    close(fd);
+    return status;
+}
+
+static void *stream_drain(void *arg) {
+    char buf[STREAM_CHUNK];
+    int fd = *(int *)arg;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR));
+    return NULL;
+}
+
+static double stream_rate(const char *tool, const char *path, int external, long long size) {
+    double best = 0;
+    for (int run = 0; run < 3; run++) {
+        unsigned long long begin = now_ns();
+        int status;
+        if (external) {
+            char *argv[] = {(char *)tool, (char *)path, NULL};
+            status = run_external(argv);
+        } else {
+            status = tool[0] == 'c' ? native_cat(path) : native_rev(path);
+        }
+        if (status != 0) return -1;
+        double rate = size / 1048576.0 / ((now_ns() - begin) / 1e9);
+        if (rate > best) best = rate;
+    }
+    return best;
+}
+
+void run_streambench(int megabytes) {
+    char dir[] = "/tmp/noire-stream-XXXXXX", path[64];
+    long long size = (long long)(megabytes > 0 ? megabytes : 1) << 20;
+    if (mkdtemp(dir) == NULL) {
+        sh_perror("mkdtemp failed");
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/dump.txt", dir);
+    int fds[2] = {-1, -1};
+    pthread_t drain;
+    FILE *sink = NULL;
+    if (write_stream_dump(path, size) || pipe2(fds, O_CLOEXEC) || (sink = fdopen(fds[1], "w")) == NULL) {
+        sh_perror("streambench");
+    } else {
+        fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+        pthread_create(&drain, NULL, stream_drain, &fds[0]);
+        sh_printf("\n");
+        sh_styled(STYLE_HEADING, "STREAM BENCHMARK:");
+        sh_printf(" %lld MB dump with 10 KB and 3 MB lines, output to a pipe, best of 3\n", size >> 20);
+        sh_printf("  %-6s %12s %12s %8s\n", "tool", "built-in", "system", "ratio");
+        const char *tools[] = {"cat", "rev"};
+        for (int i = 0; i < 2; i++) {
+            sh_flush();
+            FILE *saved = sh_out;
+            sh_out = sink;
+            double native = stream_rate(tools[i], path, 0, size);
+            double external = stream_rate(tools[i], path, 1, size);
+            sh_out = saved;
+            sh_printf("  %-6s %9.0f MB/s", tools[i], native);
+            if (external > 0) {
+                sh_printf(" %7.0f MB/s %7.1fx\n", external, native / external);
+            } else {
+                sh_printf(" %12s\n", "unavailable");
+            }
+        }
+        sh_printf("\n");
+        fclose(sink);
+        fds[1] = -1;
+        pthread_join(drain, NULL);
+    }
+    if (fds[1] >= 0) close(fds[1]);
+    if (fds[0] >= 0) close(fds[0]);
+    unlink(path);
+    rmdir(dir);
+}
+
+void cmd_streambench(char **args) {
+    run_streambench(args[1] ? atoi(args[1]) : 64);
+}
+
+void controlled_forkbomb(int count) {
+    int cap = process_cap();
+    if (count > cap) count = cap;
+
+    sh_printf("\n");
+    sh_styled(STYLE_ALERT, "CONTROLLED FORKBOMB DEMONSTRATION");
+    sh_printf("\n");
+    sh_printf("This will create %d processes then stop automatically\n", count);
+    sh_printf("All processes will terminate after 2 seconds\n");
+
+    pid_t *pids = malloc(count * sizeof(pid_t));
+    int created = 0;
+    unsigned long long begin = now_ns();
+    sh_flush();
+    for (int i = 0; i < count; i++) {
+        pid_t pid = fork();
+        if (pid > 0) STAT_ADD(forks, 1);
+        if (pid == 0) {
+            sh_printf("Fork bomb child %d created (PID: %d)\n", i+1, getpid());
+            sh_flush();
+            sleep(2);
+            _exit(0);
+        }
+        if (pid < 0) {
+            sh_perror("fork failed");
+            break;
+        }
+        pids[created++] = pid;
+    }
+
+    for (int i = 0; i < created; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+    free(pids);
+    sh_printf("\nFork bomb test complete. %d processes reaped in %.0f ms. System stable.\n\n",
+              created, (now_ns() - begin) / 1e6);
+}
+
+
+static void print_names(const char *prefix, unsigned int count, const unsigned int *names, size_t stride) {
+    sh_printf("%s", prefix);
+    for (unsigned int i = 0; i < count; i++) {
+        const unsigned int *name = (const unsigned int *)((const char *)names + i * stride);
+        sh_printf("%s%s", i ? ", " : "", pack_string(name[0]));
+    }
+    sh_printf("\n");
+}
+
+static void print_suspect_names(const char *prefix) {
+    sh_printf("%s", prefix);
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        const PackSuspect *suspect = &pack_suspects[i];
+        sh_printf("%s%s", i ? ", " : "", pack_string(suspect->alias ? suspect->alias : suspect->name));
+    }
+    sh_printf("\n");
+}
+
+void handle_investigate() {
+    unsigned int progress = session->game.progress;
+    if (progress >= pack->step_count) {
+        sh_styled(STYLE_GOOD, "You've found all the evidence! Time to accuse a suspect.");
+        sh_printf("\n");
+        return;
+    }
+
+    const PackStep *step = &pack_steps[progress];
+    if (step->reveals != CASE_NONE) {
+        const PackEvidence *item = &pack_evidence[step->reveals];
+        create_case_file(pack_string(item->file), item->content ? pack_string(item->content) : "");
+    }
+
+    sh_printf("\n");
+    sh_styled(STYLE_HEADING, "=== Crime Scene Report ===");
+    sh_printf("\n%s\n", pack_string(step->text));
+    sh_styled(STYLE_HEADING, "=========================");
+    sh_printf("\n\n");
+
+    game_investigate(&session->game);
+    if (session->game.progress >= pack->step_count) {
+        sh_styled(STYLE_GOOD, "You've found all the evidence! Time to accuse a suspect.");
+        sh_printf("\n");
+    }
+}
+
+static void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->cap - block->used < size) {
+        size_t cap = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        block = malloc(sizeof(ArenaBlock) + cap);
+        if (block == NULL) return NULL;
+        block->next = arena->blocks;
+        block->used = 0;
+        block->cap = cap;
+        arena->blocks = block;
+        arena->bytes += sizeof(ArenaBlock) + cap;
+    }
+    void *p = block->data + block->used;
+    block->used += size;
+    arena->objects++;
+    return p;
+}
+
+static void arena_free(Arena *arena) {
+    while (arena->blocks) {
+        ArenaBlock *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->bytes = 0;
+    arena->objects = 0;
+}
+
+void dialogue_reset() {
+    pthread_mutex_lock(&dialogue_lock);
+    arena_free(&dialogue_arena);
+    free(dialogue_trees);
+    dialogue_trees = calloc(pack->suspect_count, sizeof(DialogueNode *));
+    pthread_mutex_unlock(&dialogue_lock);
+}
+
+static const DialogueNode *dialogue_tree(int suspect) {
+    pthread_mutex_lock(&dialogue_lock);
+    DialogueNode *root = dialogue_trees[suspect];
+    if (root == NULL) {
+        const PackSuspect *who = &pack_suspects[suspect];
+        DialogueNode **tail[DIALOGUE_MAX_DEPTH + 1];
+        unsigned int open = 0;
+        root = arena_alloc(&dialogue_arena, sizeof(DialogueNode));
+        if (root == NULL) {
+            pthread_mutex_unlock(&dialogue_lock);
+            return NULL;
+        }
+        memset(root, 0, sizeof(*root));
+        tail[0] = &root->child;
+        for (unsigned int i = 0; i < who->line_count; i++) {
+            const PackLine *line = &pack_lines[who->lines + i];
+            DialogueNode *node = arena_alloc(&dialogue_arena, sizeof(DialogueNode));
+            if (node == NULL) {
+                pthread_mutex_unlock(&dialogue_lock);
+                return NULL;
+            }
+            /* use_pack rejects packs that skip a level or nest past the tail array */
+            assert(line->depth <= open && line->depth < DIALOGUE_MAX_DEPTH);
+            open = line->depth + (line->kind == DIALOGUE_PRESS);
+            node->line = line;
+            node->child = NULL;
+            node->next = NULL;
+            *tail[line->depth] = node;
+            tail[line->depth] = &node->next;
+            tail[line->depth + 1] = &node->child;
+        }
+        dialogue_trees[suspect] = root;
+    }
+    pthread_mutex_unlock(&dialogue_lock);
+    return root;
+}
+
+static int evidence_found(const GameState *game, unsigned int evidence) {
+    for (unsigned int i = 0; i < pack->step_count; i++) {
+        if (pack_steps[i].reveals == evidence && BIT_TEST(game->evidence, i)) return 1;
+    }
+    return 0;
+}
+
+static int print_dialogue(const DialogueNode *node, const GameState *game, int indent) {
+    int held = 0;
+    for (; node; node = node->next) {
+        const PackLine *line = node->line;
+        const char *text = pack_string(line->text);
+        if (line->kind == DIALOGUE_SAYS) {
+            sh_printf("%*s- %s\n", indent, "", text);
+        } else if (line->kind == DIALOGUE_TELL) {
+            sh_printf("%*s", indent, "");
+            sh_styled(STYLE_ALERT, "%s", text);
+            sh_printf("\n");
+        } else if (line->kind == DIALOGUE_NOTE && indent > 0) {
+            sh_printf("%*s", indent, "");
+            sh_styled(STYLE_HEADING, "(%s)", text);
+            sh_printf("\n");
+        } else if (line->kind == DIALOGUE_PRESS) {
+            if (!evidence_found(game, line->evidence)) {
+                held++;
+                continue;
+            }
+            sh_printf("%*s", indent, "");
+            sh_styled(STYLE_STATUS, "[%s] %s", evidence_name(line->evidence), text);
+            sh_printf("\n");
+            held += print_dialogue(node->child, game, indent + 2);
+        }
+    }
+    return held;
+}
+
+void handle_interview(char *suspect) {
+    int found = resolve_name(&suspect_names, suspect, suspect_name);
+    if (found == RESOLVE_AMBIGUOUS) return;
+
+    if (found >= 0) {
+        const PackSuspect *who = &pack_suspects[found];
+        const char *name = pack_string(who->name);
+        int fresh = game_interview(&session->game, found);
+        if (fresh < 0) {
+            sh_printf("\n%s isn't here. Try 'whereis %s' to find them.\n", name, name);
+            return;
+        }
+        
+        const DialogueNode *root = dialogue_tree(found);
+        if (root == NULL) {
+            sh_perror("interview");
+            return;
+        }
+        sh_printf("\n");
+        sh_styled(STYLE_SPEAKER, "%s's responses:", name);
+        sh_printf("\n");
+        int held = print_dialogue(root->child, &session->game, 0);
+        
+        if (fresh) {
+            sh_printf("\n");
+            sh_styled(STYLE_GOOD, "(New information added to your notes)");
+            sh_printf("\n");
+            
+            for (const DialogueNode *node = root->child; node; node = node->next) {
+                if (node->line->kind != DIALOGUE_NOTE) continue;
+                sh_styled(STYLE_HEADING, "(%s)", pack_string(node->line->text));
+                sh_printf("\n");
+            }
+        }
+        if (held) {
+            sh_styled(STYLE_STATUS, "(%s is holding something back. Come back with more evidence.)", name);
+            sh_printf("\n");
+        }
+    } else {
+        print_suspect_names("No suspect by that name. Try: ");
+    }
+}
+
+void handle_examine(char *item) {
+    int found = resolve_name(&evidence_names, item, evidence_name);
+    if (found == RESOLVE_AMBIGUOUS) return;
+    if (found >= 0) {
+        const PackEvidence *evidence = &pack_evidence[found];
+        show_case_file(pack_string(evidence->file));
+        if (evidence->note) {
+            sh_printf("\n");
+            sh_styled(STYLE_HEADING, "Note: %s", pack_string(evidence->note));
+            sh_printf("\n");
+        }
+        return;
+    }
+    print_names("No evidence by that name. Try: ", pack->evidence_count, &pack_evidence[0].name, sizeof(PackEvidence));
+}
+
+void handle_move(char *location) {
+    int found = resolve_name(&location_names, location, location_name);
+    if (found == RESOLVE_AMBIGUOUS) return;
+    
+    if (found >= 0) {
+        game_move(&session->game, found);
+        sh_printf("\nMoved to %s\n", pack_string(pack_locations[found].name));
+        
+        sh_printf("\nPeople here:\n");
+        int anyone_here = 0;
+        for (unsigned int i = 0; i < pack->suspect_count; i++) {
+            if (pack_suspects[i].location == (unsigned int)found) {
+                sh_printf("- %s\n", pack_string(pack_suspects[i].name));
+                anyone_here = 1;
+            }
+        }
+        if (!anyone_here) {
+            sh_printf("No suspects present\n");
+        }
+        
+        if (pack_locations[found].detail) {
+            sh_printf("\n");
+            sh_styled(STYLE_HEADING, "(%s)", pack_string(pack_locations[found].detail));
+            sh_printf("\n");
+        }
+    } else {
+        print_names("Invalid location. Choose from: ", pack->location_count, &pack_locations[0].name, sizeof(PackLocation));
+    }
+}
+
+void handle_whereis(char *suspect) {
+    int found = resolve_name(&suspect_names, suspect, suspect_name);
+    if (found == RESOLVE_AMBIGUOUS) return;
+    
+    if (found >= 0) {
+        sh_printf("\n%s is at the %s\n", pack_string(pack_suspects[found].name),
+                  pack_string(pack_locations[pack_suspects[found].location].name));
+    } else {
+        print_suspect_names("No suspect by that name. Try: ");
+    }
+}
+
+void print_case_status() {
+    int found = 0;
+    for (size_t i = 0; i < sizeof(session->game.evidence); i++) {
+        found += __builtin_popcount(session->game.evidence[i]);
+    }
+
+    sh_printf("\n");
+    sh_styled(STYLE_STATUS, "=== CASE STATUS ===");
+    sh_printf("\n");
+    sh_printf("Evidence found: %d/%u\n", found, pack->step_count);
+    sh_printf("Suspects interviewed:\n");
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        sh_printf("- %s: %s\n", pack_string(pack_suspects[i].name), 
+               BIT_TEST(session->game.interviewed, i) ? "Interviewed" : "Not interviewed");
+    }
+    sh_printf("\nUse 'examine' to review evidence files\n");
+    sh_styled(STYLE_STATUS, "==================");
+    sh_printf("\n\n");
+}
+
+void handle_accuse(char *suspect) {
+    int found = resolve_name(&suspect_names, suspect, suspect_name);
+    if (found == RESOLVE_AMBIGUOUS) return;
+    int correct = found == (int)pack->culprit;
+    print_ending(correct);
+    session->outcome = correct ? CASE_SOLVED : CASE_UNSOLVED;
+    session->running = 0;
+}
+
+void print_ending(int correct) {
+    if (correct) {
+        sh_printf("\n");
+        sh_styled(STYLE_GOOD, "**** CASE SOLVED ****\n%s confesses!\n\n%s%s%s%s%s%s\nThe Chief hands you your gold detective shield.",
+                  pack_string(pack_suspects[pack->culprit].name),
+                  pack->weapon ? "Weapon: " : "", pack->weapon ? pack_string(pack->weapon) : "", pack->weapon ? "\n" : "",
+                  pack->motive ? "Motive: " : "", pack->motive ? pack_string(pack->motive) : "", pack->motive ? "\n" : "");
+        sh_printf("\n");
+    } else {
+        sh_printf("\n");
+        sh_styled(STYLE_ALERT, "**** CASE CLOSED - UNSOLVED ****\nThe real killer walks free...\nInternal Affairs has suspended you.");
+        sh_printf("\n");
+    }
+}
+
+static void draw_welcome() {
+    const char *title = pack->title ? pack_string(pack->title) : "MURDER MYSTERY";
+    int pad = (40 - (int)strlen(title) + 1) / 2;
+    if (pad < 0) pad = 0;
+
+    sh_printf("\n");
+    sh_styled(STYLE_BANNER, "========================================\n%*s%s%*s\n========================================\n%s%s",
+              pad, "", title, pad, "", pack->intro ? pack_string(pack->intro) : "", pack->intro ? "\n\n" : "");
+    if (pack->victim) {
+        sh_styled(STYLE_ALERT, "VICTIM: %s", pack_string(pack->victim));
+        sh_printf("\n");
+    }
+    sh_styled(STYLE_HEADING, "SUSPECTS:");
+    sh_printf("\n");
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        const PackSuspect *suspect = &pack_suspects[i];
+        if (suspect->role) {
+            sh_printf("- %s (%s)\n", pack_string(suspect->name), pack_string(suspect->role));
+        } else {
+            sh_printf("- %s\n", pack_string(suspect->name));
+        }
+    }
+    sh_styled(STYLE_BANNER, "========================================");
+    sh_printf("\n\n");
+}
+
+void print_welcome_message() {
+    show_screen(&welcome_screen, draw_welcome);
+}
+
+static int snapshot_path(char *buf, size_t size, const char *slot) {
+    for (const char *p = slot; *p; p++) {
+        if (!(*p == '-' || *p == '_' || (*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))) {
+            sh_printf("Slot names may only use letters, digits, '-' and '_'\n");
+            return -1;
+        }
+    }
+    if (*slot == '\0' || strlen(slot) > 32) {
+        sh_printf("Slot names must be 1-32 characters\n");
+        return -1;
+    }
+    mkdir(SAVE_DIR, 0755);
+    snprintf(buf, size, "%s/%s.snap", SAVE_DIR, slot);
+    return 0;
+}
+
+int save_snapshot(const char *slot) {
+    char path[256], tmp[300], file[512];
+    if (snapshot_path(path, sizeof(path), slot)) return -1;
+
+    size_t cap = 1 << 16;
+    unsigned char *buf = calloc(1, cap);
+    Snapshot *snap = (Snapshot *)buf;
+    size_t used = sizeof(Snapshot);
+
+    evidence_flush(&session->store);
+    DIR *dir = opendir(session->case_dir);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) >= sizeof(snap->files[0].name)) continue;
+        if (snap->file_count == SNAPSHOT_FILES) {
+            sh_printf("Too many case files, only the first %d were saved\n", SNAPSHOT_FILES);
+            break;
+        }
+
+        case_path(file, sizeof(file), entry->d_name);
+        int fd = open(file, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+            if (fd != -1) close(fd);
+            continue;
+        }
+        if (used + st.st_size > cap) {
+            while (used + st.st_size > cap) cap *= 2;
+            buf = realloc(buf, cap);
+            snap = (Snapshot *)buf;
+        }
+
+        ssize_t n = read(fd, buf + used, st.st_size);
+        close(fd);
+        if (n < 0) continue;
+
+        SnapshotEntry *slot_entry = &snap->files[snap->file_count++];
+        strcpy(slot_entry->name, entry->d_name);
+        slot_entry->offset = used;
+        slot_entry->length = n;
+        used += n;
+    }
+    if (dir) closedir(dir);
+
+    snap->magic = SNAPSHOT_MAGIC;
+    snap->version = SNAPSHOT_VERSION;
+    snap->size = used;
+    snap->scenario = pack->checksum;
+    snap->game = session->game;
+    snap->checksum = checksum32(buf + SNAPSHOT_BODY, used - SNAPSHOT_BODY);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int ok = fd != -1 && write(fd, buf, used) == (ssize_t)used && fsync(fd) == 0;
+    if (fd != -1) close(fd);
+    if (!ok || rename(tmp, path) == -1) {
+        sh_perror(path);
+        unlink(tmp);
+        free(buf);
+        return -1;
+    }
+
+    sh_printf("Case saved to slot '%s' (%d evidence file%s, %zu bytes)\n",
+              slot, snap->file_count, snap->file_count == 1 ? "" : "s", used);
+    free(buf);
+    return 0;
+}
+
+int load_snapshot(const char *slot) {
+    char path[256], file[512];
+    if (snapshot_path(path, sizeof(path), slot)) return -1;
+
+    unsigned long long begin = now_ns();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        sh_perror(path);
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    if (st.st_size < (off_t)sizeof(Snapshot)) {
+        sh_printf("%s: not a case snapshot\n", path);
+        close(fd);
+        return -1;
+    }
+    const unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        sh_perror(path);
+        return -1;
+    }
+
+    const Snapshot *snap = (const Snapshot *)map;
+    const char *problem = NULL;
+    if (snap->magic != SNAPSHOT_MAGIC) {
+        problem = "not a case snapshot";
+    } else if (snap->version != SNAPSHOT_VERSION) {
+        problem = "saved by an incompatible version";
+    } else if (snap->size != st.st_size || snap->file_count > SNAPSHOT_FILES) {
+        problem = "truncated";
+    } else if (snap->checksum != checksum32(map + SNAPSHOT_BODY, snap->size - SNAPSHOT_BODY)) {
+        problem = "checksum mismatch";
+    } else if (snap->scenario != pack->checksum) {
+        problem = "saved from a different case";
+    }
+    for (unsigned int i = 0; problem == NULL && i < snap->file_count; i++) {
+        const SnapshotEntry *entry = &snap->files[i];
+        if (entry->offset < sizeof(Snapshot) || entry->offset > snap->size || entry->length > snap->size - entry->offset ||
+            memchr(entry->name, '\0', sizeof(entry->name)) == NULL || strchr(entry->name, '/') || entry->name[0] == '.') {
+            problem = "corrupt file table";
+        }
+    }
+    if (problem) {
+        sh_printf("%s: %s\n", path, problem);
+        munmap((void *)map, st.st_size);
+        return -1;
+    }
+
+    evidence_drop(&session->store);
+    DIR *dir = opendir(session->case_dir);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        case_path(file, sizeof(file), entry->d_name);
+        unlink(file);
+    }
+    if (dir) closedir(dir);
+
+    for (unsigned int i = 0; i < snap->file_count; i++) {
+        case_path(file, sizeof(file), snap->files[i].name);
+        int out = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out == -1 || write(out, map + snap->files[i].offset, snap->files[i].length) != (ssize_t)snap->files[i].length) {
+            sh_perror(file);
+        }
+        if (out != -1) close(out);
+        evidence_release(evidence_get(&session->store, snap->files[i].name));
+    }
+    session->game = snap->game;
+    munmap((void *)map, st.st_size);
+
+    sh_printf("Case restored from slot '%s' in %.0f us\n", slot, (now_ns() - begin) / 1e3);
+    return 0;
+}
+
+void journal_open(const char *base) {
+    char path[256];
+    if (session->journal != -1) {
+        close(session->journal);
+    }
+    mkdir(SAVE_DIR, 0755);
+    snprintf(path, sizeof(path), "%s/%s", SAVE_DIR, JOURNAL_FILE);
+    session->journal = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (base ? O_TRUNC : 0), 0644);
+    if (session->journal == -1) {
+        perror(path);
+    } else if (base) {
+        dprintf(session->journal, "# base %s\n", base);
+    }
+}
+
+void journal_append(char **args) {
+    char *line = join_args(args);
+    struct iovec iov[2] = {{line, strlen(line)}, {"\n", 1}};
+    if (writev(session->journal, iov, 2) != (ssize_t)(iov[0].iov_len + 1)) {
+        perror("journal");
+    }
+    free(line);
+}
+
+void resume_session() {
+    char path[256], base[64] = "new";
+    char *line = NULL;
+    size_t line_cap = 0;
+    snprintf(path, sizeof(path), "%s/%s", SAVE_DIR, JOURNAL_FILE);
+    FILE *journal = fopen(path, "re");
+    if (journal == NULL) {
+        sh_printf("Nothing to resume, starting a new case.\n");
+        journal_open("new");
+        return;
+    }
+
+    if (getline(&line, &line_cap, journal) == -1 || sscanf(line, "# base %63s", base) != 1) {
+        rewind(journal);
+    }
+    if (strcmp(base, "new") != 0 && load_snapshot(base)) {
+        sh_printf("Could not restore slot '%s', starting a new case.\n", base);
+        free(line);
+        fclose(journal);
+        journal_open("new");
+        return;
+    }
+
+    FILE *out = sh_out;
+    FILE *quiet = fopen("/dev/null", "we");
+    int replayed = 0;
+    sh_out = quiet ? quiet : out;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, journal)) != -1) {
+        if (line[0] == '#' || parse_input(line, len, &session->tokens) != 0) continue;
+        execute_command(session->tokens.argv);
+        replayed++;
+    }
+    free(line);
+    sh_out = out;
+    if (quiet) fclose(quiet);
+    fclose(journal);
+
+    journal_open(NULL);
+    if (strcmp(base, "new") == 0) {
+        sh_printf("Resumed case from the start with %d journaled command%s.\n", replayed, replayed == 1 ? "" : "s");
+    } else {
+        sh_printf("Resumed case from slot '%s' with %d journaled command%s.\n", base, replayed, replayed == 1 ? "" : "s");
+    }
+}
+
+void cmd_save(char **args) {
+    const char *slot = args[1] ? args[1] : "quicksave";
+    if (save_snapshot(slot) == 0) {
+        journal_open(slot);
+    }
+}
+
+void cmd_load(char **args) {
+    const char *slot = args[1] ? args[1] : "quicksave";
+    if (load_snapshot(slot) == 0) {
+        journal_open(slot);
+    }
+}
+
+void cmd_sync(char **args) {
+    (void)args;
+    int synced = evidence_sync(&session->store);
+    if (session->store.error) {
+        sh_printf("Could not write case files: %s\n", strerror(session->store.error));
+        session->store.error = 0;
+    }
+    sh_printf("Synced %d case file%s\n", synced, synced == 1 ? "" : "s");
+}
+
+static const char *gen_first_names[] = {
+    "Frankie", "Lola", "Eddie", "Ruby", "Vince", "Dolores", "Jimmy", "Mae", "Carlo", "Hazel",
+    "Buster", "Ginger", "Lou", "Pearl", "Sammy", "Ida", "Nick", "Rosa", "Walt", "Stella"
+};
+static const char *gen_last_names[] = {
+    "Delgado", "Kowalski", "Fairbanks", "Marino", "Whitlock", "Castellano", "Brennan", "Okafor", "Lindqvist", "Abernathy",
+    "Ruiz", "Hargrove", "Nakamura", "Petrakis", "Sullivan", "Vance", "Moreau", "Gallagher", "Ivanov", "Crowley"
+};
+static const char *gen_nicknames[] = {
+    "Knuckles", "Silk", "Lucky", "The Duchess", "Two-Tone", "Hush", "Smiles", "The Ghost", "Slim", "Dice"
+};
+static const char *gen_roles[] = {
+    "bookie", "torch singer", "bootlegger", "private eye", "landlord", "bartender", "pawnbroker", "chauffeur",
+    "city councilman", "nightclub owner", "dock foreman", "newspaperman", "nurse", "card dealer", "tailor"
+};
+static const char *gen_places[] = {
+    "Union Station", "Chinatown Alley", "Blue Note Club", "Pier 13", "Bunker Hill Boarding House",
+    "Angels Flight", "Central Market", "Griffith Observatory", "Santa Monica Pier", "Ambassador Hotel",
+    "Echo Park Boathouse", "Bradbury Building"
+};
+static const char *gen_victims[] = {
+    "Johnny 'Rats' Malone", "Benny Sorrento", "Vera Lockhart", "Harold 'Ledger' Finch", "Dixie Calloway", "Manny Ortega"
+};
+static const char *gen_weapons[] = {
+    "a .38 snubnose", "a straight razor", "a length of piano wire", "a fireplace poker", "a bottle of strychnine", "a .45 automatic"
+};
+static const char *gen_motives[] = {
+    "The victim was about to testify to the grand jury",
+    "The victim had run off with the money from a rigged card game",
+    "The victim was blackmailing the killer over an old affair",
+    "The victim knew who really set the warehouse fire",
+    "The victim had sold the killer out to a rival gang"
+};
+
+typedef struct {
+    const char *name;
+    const char *evidence;
+    const char *file;
+    const char *step;
+    const char *content;
+    const char *says;
+    const char *values[5];
+} GenTrait;
+
+static const GenTrait gen_traits[GEN_TRAITS] = {
+    {"smoke", "cigarette", "cigarette.txt", "A cigarette butt lies by the body (type 'examine cigarette')",
+     "Half-smoked, still warm. The brand: %s", "I only smoke %s, always have.",
+     {"Lucky Strikes", "Chesterfields", "Camels", "Pall Malls", "Old Golds"}},
+    {"shoes", "footprints", "footprints.txt", "Muddy footprints lead away from the scene (type 'examine footprints')",
+     "Plaster cast of the prints: %s", "You like my %s? Wore 'em all night.",
+     {"wingtips", "work boots", "high heels", "loafers", "spats"}},
+    {"car", "tire_tracks", "tire_tracks.txt", "A witness saw a car speed off (type 'examine tire_tracks')",
+     "The getaway car was %s", "I drove %s down here tonight.",
+     {"a black Packard", "a green Hudson", "a Buick convertible", "a Ford pickup", "a yellow cab"}},
+    {"hand", "coroner", "coroner.txt", "The coroner has a report on the wound (type 'examine coroner')",
+     "The angle of the wound says the killer is %s", "Me? I'm %s, ask anybody.",
+     {"left-handed", "right-handed"}}
+};
+
+static unsigned long long gen_next(unsigned long long *state) {
+    unsigned long long z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static int gen_range(unsigned long long *state, int n) {
+    return gen_next(state) % n;
+}
+
+static int gen_trait_values(int trait) {
+    int n = 0;
+    while (n < 5 && gen_traits[trait].values[n]) n++;
+    return n;
+}
+
+static void gen_pick_distinct(unsigned long long *state, int pool, int count, int *out) {
+    for (int i = 0; i < count; i++) {
+        int pick;
+        int taken;
+        do {
+            pick = gen_range(state, pool);
+            taken = 0;
+            for (int j = 0; j < i; j++) {
+                if (out[j] == pick) taken = 1;
+            }
+        } while (taken);
+        out[i] = pick;
+    }
+}
+
+static int gen_matches(const GenCase *c, int suspect) {
+    for (int e = 0; e < c->evidence_count; e++) {
+        int trait = c->evidence[e];
+        if (c->traits[suspect][trait] != c->traits[c->culprit][trait]) return 0;
+    }
+    return 1;
+}
+
+void generate_case(unsigned long long seed, GenCase *c) {
+    unsigned long long state = seed;
+    int first[GEN_MAX_SUSPECTS], last[GEN_MAX_SUSPECTS];
+
+    memset(c, 0, sizeof(*c));
+    c->seed = seed;
+    c->location_count = 4 + gen_range(&state, GEN_MAX_LOCATIONS - 3);
+    c->suspect_count = 4 + gen_range(&state, GEN_MAX_SUSPECTS - 3);
+    c->culprit = gen_range(&state, c->suspect_count);
+    c->victim = gen_range(&state, sizeof(gen_victims) / sizeof(gen_victims[0]));
+    c->weapon = gen_range(&state, sizeof(gen_weapons) / sizeof(gen_weapons[0]));
+    c->motive = gen_range(&state, sizeof(gen_motives) / sizeof(gen_motives[0]));
+
+    gen_pick_distinct(&state, sizeof(gen_places) / sizeof(gen_places[0]), c->location_count - 1, c->locations);
+    gen_pick_distinct(&state, sizeof(gen_first_names) / sizeof(gen_first_names[0]), c->suspect_count, first);
+    gen_pick_distinct(&state, sizeof(gen_last_names) / sizeof(gen_last_names[0]), c->suspect_count, last);
+    for (int i = 0; i < c->suspect_count; i++) {
+        c->first[i] = first[i];
+        c->last[i] = last[i];
+        c->nickname[i] = gen_range(&state, 3) == 0 ? gen_range(&state, sizeof(gen_nicknames) / sizeof(gen_nicknames[0])) : -1;
+        c->role[i] = gen_range(&state, sizeof(gen_roles) / sizeof(gen_roles[0]));
+        c->location[i] = gen_range(&state, c->location_count);
+        for (int t = 0; t < GEN_TRAITS; t++) {
+            c->traits[i][t] = gen_range(&state, gen_trait_values(t));
+        }
+    }
+    for (int i = 0; i < c->suspect_count; i++) {
+        for (int j = 0; j < i; j++) {
+            if (c->nickname[i] >= 0 && c->nickname[i] == c->nickname[j]) c->nickname[i] = -1;
+        }
+    }
+
+    int used[GEN_TRAITS] = {0};
+    for (;;) {
+        int remaining = 0;
+        for (int i = 0; i < c->suspect_count; i++) {
+            if (i != c->culprit && gen_matches(c, i)) remaining++;
+        }
+        if ((remaining == 0 && c->evidence_count >= GEN_MIN_EVIDENCE) || c->evidence_count == GEN_TRAITS) break;
+
+        int best = -1, best_left = remaining + 1;
+        for (int t = 0; t < GEN_TRAITS; t++) {
+            if (used[t]) continue;
+            c->evidence[c->evidence_count] = t;
+            c->evidence_count++;
+            int left = 0;
+            for (int i = 0; i < c->suspect_count; i++) {
+                if (i != c->culprit && gen_matches(c, i)) left++;
+            }
+            c->evidence_count--;
+            if (left < best_left) {
+                best = t;
+                best_left = left;
+            }
+        }
+        used[best] = 1;
+        c->evidence[c->evidence_count++] = best;
+    }
+
+    for (int i = 0; i < c->suspect_count; i++) {
+        if (i != c->culprit && gen_matches(c, i)) {
+            int trait = c->evidence[gen_range(&state, c->evidence_count)];
+            c->traits[i][trait] = (c->traits[c->culprit][trait] + 1 + gen_range(&state, gen_trait_values(trait) - 1)) % gen_trait_values(trait);
+        }
+    }
+
+    for (int i = c->evidence_count - 1; i > 0; i--) {
+        int j = gen_range(&state, i + 1);
+        int swap = c->evidence[i];
+        c->evidence[i] = c->evidence[j];
+        c->evidence[j] = swap;
+    }
+}
+
+const char *check_case(const GenCase *c) {
+    int suspects = 0;
+    int seen[GEN_TRAITS] = {0};
+
+    if (c->suspect_count < 2 || c->suspect_count > GEN_MAX_SUSPECTS || c->location_count > GEN_MAX_LOCATIONS) {
+        return "bad counts";
+    }
+    if (c->evidence_count < GEN_MIN_EVIDENCE) {
+        return "not enough evidence";
+    }
+    for (int e = 0; e < c->evidence_count; e++) {
+        if (seen[c->evidence[e]]++) return "evidence repeated";
+    }
+    for (int i = 0; i < c->suspect_count; i++) {
+        if (c->location[i] < 0 || c->location[i] >= c->location_count) return "suspect nowhere";
+        for (int j = 0; j < i; j++) {
+            if (c->first[i] == c->first[j] || c->last[i] == c->last[j]) return "names collide";
+            if (c->nickname[i] >= 0 && c->nickname[i] == c->nickname[j]) return "nicknames collide";
+        }
+        if (gen_matches(c, i)) suspects++;
+    }
+    if (!gen_matches(c, c->culprit)) {
+        return "evidence contradicts the culprit";
+    }
+    if (suspects != 1) {
+        return "evidence fits more than one suspect";
+    }
+    return NULL;
+}
+
+char *case_to_text(const GenCase *c) {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+
+    fprintf(out, "case generated-%llu\n", c->seed);
+    fprintf(out, "title CASE FILE #%llu\n", c->seed % 100000);
+    fprintf(out, "intro Another night, another body in the city of angels.\n");
+    fprintf(out, "intro The evidence will point to exactly one of them.\n");
+    fprintf(out, "victim %s\n", gen_victims[c->victim]);
+    fprintf(out, "weapon %s\n", gen_weapons[c->weapon]);
+    fprintf(out, "motive %s\n", gen_motives[c->motive]);
+
+    fprintf(out, "location Police Station\n");
+    for (int i = 0; i < c->location_count - 1; i++) {
+        fprintf(out, "location %s\n", gen_places[c->locations[i]]);
+    }
+    for (int i = 0; i < c->suspect_count; i++) {
+        if (c->nickname[i] >= 0) {
+            fprintf(out, "suspect %s '%s' %s\n", gen_first_names[c->first[i]], gen_nicknames[c->nickname[i]], gen_last_names[c->last[i]]);
+        } else {
+            fprintf(out, "suspect %s %s\n", gen_first_names[c->first[i]], gen_last_names[c->last[i]]);
+        }
+        fprintf(out, "  alias %s\n", gen_first_names[c->first[i]]);
+        fprintf(out, "  role %s\n", gen_roles[c->role[i]]);
+        fprintf(out, "  at %s\n", c->location[i] == 0 ? "Police Station" : gen_places[c->locations[c->location[i] - 1]]);
+        if (i == c->culprit) fprintf(out, "  culprit\n");
+        for (int t = 0; t < GEN_TRAITS; t++) {
+            fprintf(out, "  says ");
+            fprintf(out, gen_traits[t].says, gen_traits[t].values[c->traits[i][t]]);
+            fprintf(out, "\n");
+        }
+    }
+    for (int e = 0; e < c->evidence_count; e++) {
+        const GenTrait *trait = &gen_traits[c->evidence[e]];
+        fprintf(out, "evidence %s\n  file %s\n  content ", trait->evidence, trait->file);
+        fprintf(out, trait->content, trait->values[c->traits[c->culprit][c->evidence[e]]]);
+        fprintf(out, "\n");
+    }
+    for (int e = 0; e < c->evidence_count; e++) {
+        const GenTrait *trait = &gen_traits[c->evidence[e]];
+        fprintf(out, "step %s\n  reveals %s\n", trait->step, trait->evidence);
+    }
+
+    fclose(out);
+    return text;
+}
+
+typedef struct {
+    unsigned long long base_seed;
+    int total;
+    int next;
+    int generated;
+    int rejected;
+    unsigned long long bytes;
+    const char *dir;
+} GenPool;
+
+static void *gencases_worker(void *arg) {
+    GenPool *pool = arg;
+    GenCase c;
+    char error[256], path[512];
+
+    for (;;) {
+        int index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (index >= pool->total) break;
+
+        unsigned long long seed = pool->base_seed + index;
+        generate_case(seed, &c);
+        if (check_case(&c)) {
+            __atomic_fetch_add(&pool->rejected, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        char *text = case_to_text(&c);
+        size_t size;
+        unsigned char *data = compile_case(text, &size, error, sizeof(error));
+        free(text);
+        if (data == NULL) {
+            __atomic_fetch_add(&pool->rejected, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (pool->dir) {
+            snprintf(path, sizeof(path), "%s/case-%llu.pack", pool->dir, seed);
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd == -1 || write(fd, data, size) != (ssize_t)size) {
+                perror(path);
+            }
+            if (fd != -1) close(fd);
+        }
+        free(data);
+        __atomic_fetch_add(&pool->generated, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&pool->bytes, size, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+void run_gencases(int total, unsigned long long seed, const char *dir) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if (threads > total) threads = total > 0 ? total : 1;
+    if (dir && mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        perror(dir);
+        return;
+    }
+
+    GenPool pool = {seed, total, 0, 0, 0, 0, dir};
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    unsigned long long begin = now_ns();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, gencases_worker, &pool);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double seconds = (now_ns() - begin) / 1e9;
+    free(workers);
+
+    sh_printf("Generated %d solvable case%s from seed %llu in %.1f ms on %d thread%s (%.0f cases/sec, %llu bytes of packs)\n",
+              pool.generated, pool.generated == 1 ? "" : "s", seed, seconds * 1e3, threads, threads == 1 ? "" : "s",
+              seconds > 0 ? pool.generated / seconds : 0.0, pool.bytes);
+    if (pool.rejected) {
+        sh_printf("%d case%s failed the solvability check\n", pool.rejected, pool.rejected == 1 ? "" : "s");
+    }
+    if (dir) {
+        sh_printf("Packs written to %s/case-<seed>.pack\n", dir);
+    }
+}
+
+void cmd_gencases(char **args) {
+    int total = args[1] ? atoi(args[1]) : 1000;
+    unsigned long long seed = args[2] ? strtoull(args[2], NULL, 10) : (unsigned long long)time(NULL);
+    if (total <= 0) {
+        sh_printf("Usage: gencases [count] [seed] [directory]\n");
+        return;
+    }
+    run_gencases(total, seed, args[1] && args[2] ? args[3] : NULL);
+}
+
+int load_generated_case(unsigned long long seed) {
+    GenCase c;
+    char error[256];
+    generate_case(seed, &c);
+    const char *problem = check_case(&c);
+    if (problem) {
+        fprintf(stderr, "case %llu: %s\n", seed, problem);
+        return -1;
+    }
+
+    char *text = case_to_text(&c);
+    size_t size;
+    unsigned char *data = compile_case(text, &size, error, sizeof(error));
+    free(text);
+    if (data == NULL) {
+        fprintf(stderr, "case %llu: %s\n", seed, error);
+        return -1;
+    }
+    return use_pack(data, size, "generated case");
+}
+
+static int solver_goal(const GameState *state) {
+    int evidence = 0, interviewed = 0;
+    for (size_t i = 0; i < sizeof(state->evidence); i++) {
+        evidence += __builtin_popcount(state->evidence[i]);
+        interviewed += __builtin_popcount(state->interviewed[i]);
+    }
+    return evidence == (int)pack->step_count && interviewed == (int)pack->suspect_count;
+}
+
+static void solver_add(Solver *solver, int parent, const GameState *state, int action, int arg) {
+    int index = __atomic_fetch_add(&solver->count, 1, __ATOMIC_RELAXED);
+    if (index >= solver->max_nodes) {
+        solver->overflow = 1;
+        return;
+    }
+
+    SolverNode *node = &solver->nodes[index];
+    node->state = *state;
+    node->parent = parent;
+    node->action = action;
+    node->arg = arg;
+    node->dead = 0;
+
+    size_t slot = checksum32(state, sizeof(*state)) & solver->slot_mask;
+    for (;;) {
+        unsigned int current = __atomic_load_n(&solver->slots[slot], __ATOMIC_ACQUIRE);
+        if (current == 0) {
+            if (__atomic_compare_exchange_n(&solver->slots[slot], &current, index + 1, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+        }
+        if (current && memcmp(&solver->nodes[current - 1].state, state, sizeof(*state)) == 0) {
+            node->dead = 1;
+            return;
+        }
+        if (current) {
+            slot = (slot + 1) & solver->slot_mask;
+        }
+    }
+
+    if (solver_goal(state)) {
+        int none = -1;
+        __atomic_compare_exchange_n(&solver->goal, &none, index, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+}
+
+static void solver_expand(Solver *solver, int index) {
+    const GameState *state = &solver->nodes[index].state;
+    unsigned int here = state->progress % pack->location_count;
+    GameState next;
+
+    if (state->progress < pack->step_count) {
+        next = *state;
+        game_investigate(&next);
+        solver_add(solver, index, &next, SOLVER_INVESTIGATE, 0);
+    }
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        next = *state;
+        if (pack_suspects[i].location == here && game_interview(&next, i) > 0) {
+            solver_add(solver, index, &next, SOLVER_INTERVIEW, i);
+        }
+    }
+    for (unsigned int i = 0; i < pack->location_count; i++) {
+        if (i == state->progress) continue;
+        next = *state;
+        game_move(&next, i);
+        solver_add(solver, index, &next, SOLVER_MOVE, i);
+    }
+}
+
+static void solver_level(Solver *solver) {
+    unsigned long long expanded = 0;
+    for (;;) {
+        int begin = __atomic_fetch_add(&solver->next, SOLVER_CHUNK, __ATOMIC_RELAXED);
+        if (begin >= solver->level_end) break;
+        int end = begin + SOLVER_CHUNK < solver->level_end ? begin + SOLVER_CHUNK : solver->level_end;
+        for (int i = begin; i < end && !solver->overflow; i++) {
+            if (!solver->nodes[i].dead) {
+                solver_expand(solver, i);
+                expanded++;
+            }
+        }
+    }
+    __atomic_fetch_add(&solver->expanded, expanded, __ATOMIC_RELAXED);
+}
+
+static void *solver_worker(void *arg) {
+    Solver *solver = arg;
+    for (;;) {
+        pthread_barrier_wait(&solver->start);
+        if (solver->done) break;
+        solver_level(solver);
+        pthread_barrier_wait(&solver->finish);
+    }
+    return NULL;
+}
+
+int solve_case(const char *script_path) {
+    Solver solver = {0};
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+
+    solver.max_nodes = SOLVER_MAX_STATES;
+    solver.slot_mask = SOLVER_MAX_STATES * 2 - 1;
+    solver.goal = -1;
+    solver.nodes = mmap(NULL, SOLVER_MAX_STATES * sizeof(SolverNode), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    solver.slots = mmap(NULL, SOLVER_MAX_STATES * 2 * sizeof(unsigned int), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (solver.nodes == MAP_FAILED || solver.slots == MAP_FAILED) {
+        sh_perror("solver");
+        return -1;
+    }
+
+    GameState start;
+    memset(&start, 0, sizeof(start));
+    solver_add(&solver, -1, &start, SOLVER_START, 0);
+
+    pthread_barrier_init(&solver.start, NULL, threads);
+    pthread_barrier_init(&solver.finish, NULL, threads);
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    for (int i = 1; i < threads; i++) {
+        pthread_create(&workers[i], NULL, solver_worker, &solver);
+    }
+
+    unsigned long long begin = now_ns();
+    int level_start = 0, depth = 0;
+    while (solver.goal < 0 && !solver.overflow) {
+        int level_end = solver.count;
+        if (level_end == level_start) break;
+        solver.level_end = level_end;
+        solver.next = level_start;
+        pthread_barrier_wait(&solver.start);
+        solver_level(&solver);
+        pthread_barrier_wait(&solver.finish);
+        level_start = level_end;
+        depth++;
+    }
+    solver.done = 1;
+    pthread_barrier_wait(&solver.start);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    pthread_barrier_destroy(&solver.start);
+    pthread_barrier_destroy(&solver.finish);
+
+    double seconds = (now_ns() - begin) / 1e9;
+    int states = solver.count < solver.max_nodes ? solver.count : solver.max_nodes;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    int result = -1;
+    if (solver.goal >= 0) {
+        int path[SOLVER_MAX_DEPTH];
+        int length = 0;
+        for (int i = solver.goal; solver.nodes[i].parent >= 0 && length < SOLVER_MAX_DEPTH; i = solver.nodes[i].parent) {
+            path[length++] = i;
+        }
+
+        FILE *script = sh_out;
+        if (script_path && (script = fopen(script_path, "w")) == NULL) {
+            sh_perror(script_path);
+        } else {
+            for (int i = length - 1; i >= 0; i--) {
+                const SolverNode *node = &solver.nodes[path[i]];
+                if (node->action == SOLVER_INVESTIGATE) {
+                    fprintf(script, "investigate\n");
+                } else if (node->action == SOLVER_MOVE) {
+                    fprintf(script, "move %s\n", location_name(node->arg));
+                } else {
+                    fprintf(script, "interview %s\n", suspect_name(node->arg));
+                }
+            }
+            fprintf(script, "accuse %s\n", suspect_name(pack->culprit));
+            if (script_path) fclose(script);
+            result = 0;
+        }
+        sh_printf("Solved in %d commands: %d to find every clue and interview every suspect, then the accusation%s%s\n",
+                  length + 1, length, script_path ? ". Script written to " : "", script_path ? script_path : "");
+    } else if (solver.overflow) {
+        sh_printf("Gave up after %d states: the case is too large to search exhaustively\n", SOLVER_MAX_STATES);
+    } else {
+        sh_printf("No way to find all evidence and interview every suspect: the case cannot be closed\n");
+    }
+    sh_printf("Explored %d states over %d levels in %.1f ms on %d thread%s (%.0f states/sec), peak memory %ld KB\n",
+              states, depth, seconds * 1e3, threads, threads == 1 ? "" : "s",
+              seconds > 0 ? states / seconds : 0.0, usage.ru_maxrss);
+
+    munmap(solver.nodes, SOLVER_MAX_STATES * sizeof(SolverNode));
+    munmap(solver.slots, SOLVER_MAX_STATES * 2 * sizeof(unsigned int));
+    return result;
+}
+
+void cmd_solve(char **args) {
+    solve_case(args[1]);
+}
+
+int game_investigate(GameState *game) {
+    if (game->progress >= pack->step_count) return -1;
+    int step = game->progress;
+    BIT_SET(game->evidence, step);
+    game->progress++;
+    return step;
+}
+
+void game_move(GameState *game, int location) {
+    game->progress = location;
+}
+
+int game_interview(GameState *game, int suspect) {
+    if (pack_suspects[suspect].location != game->progress % pack->location_count) return -1;
+    if (BIT_TEST(game->interviewed, suspect)) return 0;
+    BIT_SET(game->interviewed, suspect);
+    return 1;
+}
+
+static void put_varint(FILE *out, unsigned long long value) {
+    while (value >= 0x80) {
+        putc((value & 0x7f) | 0x80, out);
+        value >>= 7;
+    }
+    putc(value, out);
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end, unsigned long long *value) {
+    *value = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*p)++;
+        *value |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return -1;
+}
+
+static unsigned int recorder_string(Recorder *rec, const char *text) {
+    size_t known = rec->strings.count;
+    unsigned int id = intern_string(&rec->strings, text);
+    if (rec->strings.count != known) {
+        size_t len = strlen(text);
+        putc(TRANSCRIPT_STRING, rec->file);
+        put_varint(rec->file, len);
+        fwrite(text, 1, len, rec->file);
+    }
+    return id;
+}
+
+static void recorder_state(Recorder *rec, int tag) {
+    putc(tag, rec->file);
+    put_varint(rec->file, rec->step);
+    fwrite(&session->game, sizeof(session->game), 1, rec->file);
+}
+
+int recorder_start(const char *path) {
+    FILE *file = fopen(path, "we");
+    if (file == NULL) {
+        sh_perror(path);
+        return -1;
+    }
+    Recorder *rec = calloc(1, sizeof(Recorder));
+    TranscriptHeader header = {TRANSCRIPT_MAGIC, TRANSCRIPT_VERSION, pack->checksum, sizeof(GameState)};
+    fwrite(&header, sizeof(header), 1, file);
+    rec->file = file;
+    rec->started = now_ns();
+    pthread_mutex_init(&rec->lock, NULL);
+    session->recorder = rec;
+    recorder_state(rec, TRANSCRIPT_RESTORE);
+    return 0;
+}
+
+void recorder_stop() {
+    Recorder *rec = session->recorder;
+    if (rec == NULL) return;
+    fclose(rec->file);
+    free(rec->strings.pool);
+    free(rec->strings.slots);
+    pthread_mutex_destroy(&rec->lock);
+    free(rec);
+    session->recorder = NULL;
+}
+
+void recorder_command(char **args, const char *command) {
+    Recorder *rec = session->recorder;
+    char *arg = args[1] ? join_args(args + 1) : NULL;
+    pthread_mutex_lock(&rec->lock);
+    unsigned long long now = (now_ns() - rec->started) / 1000;
+    if (rec->step % TRANSCRIPT_CHECKPOINT == 0) {
+        recorder_state(rec, TRANSCRIPT_CHECKPOINT_STATE);
+    }
+    unsigned int name = recorder_string(rec, command);
+    unsigned int value = arg ? recorder_string(rec, arg) : 0;
+    putc(TRANSCRIPT_COMMAND, rec->file);
+    put_varint(rec->file, now - rec->last_us);
+    put_varint(rec->file, name);
+    put_varint(rec->file, value);
+    rec->last_us = now;
+    rec->step++;
+    pthread_mutex_unlock(&rec->lock);
+    free(arg);
+}
+
+void recorder_restored() {
+    Recorder *rec = session->recorder;
+    pthread_mutex_lock(&rec->lock);
+    recorder_state(rec, TRANSCRIPT_RESTORE);
+    pthread_mutex_unlock(&rec->lock);
+}
+
+static int replay_action(const char *name) {
+    if (strcmp(name, "investigate") == 0) return SOLVER_INVESTIGATE;
+    if (strcmp(name, "move") == 0) return SOLVER_MOVE;
+    if (strcmp(name, "interview") == 0) return SOLVER_INTERVIEW;
+    if (strcmp(name, "accuse") == 0) return REPLAY_ACCUSE;
+    if (strcmp(name, "exit") == 0) return REPLAY_EXIT;
+    return SOLVER_START;
+}
+
+static void free_replay(Replay *replay) {
+    free(replay->pool);
+    free(replay->commands);
+    free(replay->marks);
+    if (replay->data) munmap((void *)replay->data, replay->size);
+}
+
+int load_replay(const char *path, Replay *replay) {
+    memset(replay, 0, sizeof(*replay));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        sh_perror(path);
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    if (st.st_size < (off_t)sizeof(TranscriptHeader)) {
+        sh_printf("%s: not a transcript\n", path);
+        close(fd);
+        return -1;
+    }
+    replay->size = st.st_size;
+    replay->data = mmap(NULL, replay->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (replay->data == MAP_FAILED) {
+        replay->data = NULL;
+        sh_perror(path);
+        return -1;
+    }
+
+    const TranscriptHeader *header = (const TranscriptHeader *)replay->data;
+    if (header->magic != TRANSCRIPT_MAGIC || header->version != TRANSCRIPT_VERSION || header->state_size != sizeof(GameState)) {
+        sh_printf("%s: not a transcript from this version\n", path);
+        free_replay(replay);
+        return -1;
+    }
+    if (header->pack != pack->checksum) {
+        sh_printf("%s: recorded against a different case\n", path);
+        free_replay(replay);
+        return -1;
+    }
+
+    size_t pool_cap = 4096, command_cap = 4096, mark_cap = 64;
+    replay->pool = malloc(pool_cap);
+    replay->commands = malloc(command_cap * sizeof(ReplayCommand));
+    replay->marks = malloc(mark_cap * sizeof(ReplayMark));
+    const unsigned char *p = replay->data + sizeof(TranscriptHeader);
+    const unsigned char *end = replay->data + replay->size;
+    unsigned long long elapsed = 0;
+
+    const unsigned char *record = p;
+    for (; p < end; record = p) {
+        int tag = *p++;
+        unsigned long long a, b, c;
+        if (tag == TRANSCRIPT_STRING) {
+            if (get_varint(&p, end, &a) || a > (unsigned long long)(end - p)) break;
+            while (replay->pool_used + a + 1 > pool_cap) pool_cap *= 2;
+            replay->pool = realloc(replay->pool, pool_cap);
+            memcpy(replay->pool + replay->pool_used, p, a);
+            replay->pool[replay->pool_used + a] = '\0';
+            replay->pool_used += a + 1;
+            p += a;
+        } else if (tag == TRANSCRIPT_COMMAND) {
+            if (get_varint(&p, end, &a) || get_varint(&p, end, &b) || get_varint(&p, end, &c)) break;
+            if (b == 0 || b > replay->pool_used || c > replay->pool_used) break;
+            if (replay->count == command_cap) {
+                command_cap *= 2;
+                replay->commands = realloc(replay->commands, command_cap * sizeof(ReplayCommand));
+            }
+            elapsed += a;
+            replay->commands[replay->count].name = b;
+            replay->commands[replay->count].arg = c;
+            replay->count++;
+        } else if (tag == TRANSCRIPT_CHECKPOINT_STATE || tag == TRANSCRIPT_RESTORE) {
+            if (get_varint(&p, end, &a) || (size_t)(end - p) < sizeof(GameState) || a != replay->count) break;
+            if (replay->mark_count == mark_cap) {
+                mark_cap *= 2;
+                replay->marks = realloc(replay->marks, mark_cap * sizeof(ReplayMark));
+            }
+            replay->marks[replay->mark_count].step = a;
+            replay->marks[replay->mark_count].restore = tag == TRANSCRIPT_RESTORE;
+            memcpy(&replay->marks[replay->mark_count].state, p, sizeof(GameState));
+            replay->mark_count++;
+            p += sizeof(GameState);
+        } else {
+            break;
+        }
+    }
+    if (record < end) {
+        sh_printf("%s: damaged after %zu commands, replaying what was read\n", path, replay->count);
+    }
+    replay->elapsed_us = elapsed;
+    return 0;
+}
+
+static int replay_entity(Replay *replay, const Trie *trie, unsigned int arg) {
+    if (arg == 0) return RESOLVE_NONE;
+    return trie_lookup(trie, replay->pool + arg - 1);
+}
+
+int run_replay(Replay *replay, size_t target, int seek, GameState *state) {
+    size_t mark = 0;
+    int outcome = CASE_OPEN;
+    int *actions = malloc((replay->pool_used + 1) * sizeof(int));
+    int *entities = malloc((replay->pool_used + 1) * sizeof(int));
+    for (size_t i = 0; i <= replay->pool_used; i++) {
+        actions[i] = -1;
+        entities[i] = REPLAY_UNRESOLVED;
+    }
+
+    while (seek && mark + 1 < replay->mark_count && replay->marks[mark + 1].step <= target) mark++;
+    memset(state, 0, sizeof(*state));
+    size_t step = 0;
+    if (replay->mark_count) {
+        *state = replay->marks[mark].state;
+        step = replay->marks[mark].step;
+        mark++;
+    }
+
+    replay->diverged = 0;
+    for (; step < target; step++) {
+        while (mark < replay->mark_count && replay->marks[mark].step == step) {
+            if (replay->marks[mark].restore) {
+                *state = replay->marks[mark].state;
+            } else if (memcmp(state, &replay->marks[mark].state, sizeof(*state)) != 0) {
+                replay->diverged++;
+                *state = replay->marks[mark].state;
+            }
+            mark++;
+        }
+
+        const ReplayCommand *command = &replay->commands[step];
+        if (actions[command->name] < 0) {
+            actions[command->name] = replay_action(replay->pool + command->name - 1);
+        }
+        int action = actions[command->name];
+        if (action == SOLVER_START) continue;
+        if (action == SOLVER_INVESTIGATE) {
+            game_investigate(state);
+            continue;
+        }
+        if (action == REPLAY_EXIT) {
+            outcome = CASE_ABANDONED;
+            continue;
+        }
+
+        int *entity = &entities[command->arg];
+        if (*entity == REPLAY_UNRESOLVED) {
+            *entity = replay_entity(replay, action == SOLVER_MOVE ? &location_names : &suspect_names, command->arg);
+        }
+        if (*entity < 0) {
+            if (action == REPLAY_ACCUSE && *entity == RESOLVE_NONE) outcome = CASE_UNSOLVED;
+            continue;
+        }
+        if (action == SOLVER_MOVE) {
+            game_move(state, *entity);
+        } else if (action == SOLVER_INTERVIEW) {
+            game_interview(state, *entity);
+        } else {
+            outcome = *entity == (int)pack->culprit ? CASE_SOLVED : CASE_UNSOLVED;
+        }
+    }
+    while (mark < replay->mark_count && replay->marks[mark].step == step && replay->marks[mark].restore) {
+        *state = replay->marks[mark++].state;
+    }
+
+    free(actions);
+    free(entities);
+    return outcome;
+}
+
+int replay_transcript(const char *path, const char *at) {
+    Replay replay;
+    GameState state;
+    const char *outcomes[] = {"solved", "unsolved", "abandoned", "open"};
+
+    if (load_replay(path, &replay)) return -1;
+    size_t target = replay.count;
+    if (at) {
+        target = strtoull(at, NULL, 10);
+        if (target > replay.count) target = replay.count;
+    }
+
+    unsigned long long begin = now_ns();
+    run_replay(&replay, replay.count, 0, &state);
+    double full_seconds = (now_ns() - begin) / 1e9;
+    int diverged = replay.diverged;
+    begin = now_ns();
+    int outcome = run_replay(&replay, target, 1, &state);
+    double seconds = (now_ns() - begin) / 1e9;
+
+    session->game = state;
+    sh_printf("Replayed %s to step %zu of %zu (%.1f s of play) in %.3f ms; a full replay runs at %.0f commands/sec\n",
+              path, target, replay.count, replay.elapsed_us / 1e6, seconds * 1e3,
+              full_seconds > 0 ? replay.count / full_seconds : 0.0);
+    sh_printf("Case is %s, you are at the %s", outcomes[outcome], location_name(state.progress % pack->location_count));
+    if (diverged) {
+        sh_printf(". Warning: %d checkpoint%s did not match the replayed state", diverged, diverged == 1 ? "" : "s");
+    }
+    sh_printf("\n");
+    free_replay(&replay);
+    return 0;
+}
+
+void cmd_record(char **args) {
+    if (args[1] == NULL || strcmp(args[1], "stop") == 0) {
+        if (session->recorder) {
+            sh_printf("Recorded %llu commands\n", session->recorder->step);
+            recorder_stop();
+        } else {
+            sh_printf("Not recording. Usage: record [file|stop]\n");
+        }
+        return;
+    }
+    recorder_stop();
+    if (recorder_start(args[1]) == 0) {
+        sh_printf("Recording commands to %s\n", args[1]);
+    }
+}
+
+void cmd_replay(char **args) {
+    replay_transcript(args[1], args[2]);
+}
+
+unsigned long long alloc_count;
+
+/* Counting allocations replaces the allocator, so it is only built with -DNOIRE_COUNT_ALLOCS. */
+#ifdef NOIRE_COUNT_ALLOCS
+#define ALLOCS_COUNTED 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    void *block = __libc_memalign(alignment, size);
+    if (block == NULL) return ENOMEM;
+    *ptr = block;
+    return 0;
+}
+#else
+#define ALLOCS_COUNTED 0
+#endif
+
+typedef void (*BenchOp)(char **lines, int count);
+
+typedef struct {
+    char name[64];
+    const char *kind;
+    BenchOp op;
+    char **lines;
+    int count;
+    long iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double syscalls_per_op;
+} Benchmark;
+
+GameState bench_start;
+int bench_next;
+
+static void bench_parse(char **lines, int count) {
+    char buf[MAX_INPUT_SIZE];
+    int len = snprintf(buf, sizeof(buf), "%s", lines[bench_next++ % count]);
+    parse_input(buf, len, &session->tokens);
+}
+
+static void bench_dispatch(char **lines, int count) {
+    if (find_command(lines[bench_next++ % count]) == NULL) abort();
+}
+
+static void bench_resolve(char **lines, int count) {
+    if (trie_lookup(&suspect_names, lines[bench_next++ % count]) == RESOLVE_NONE) abort();
+}
+
+static void bench_create_file(char **lines, int count) {
+    (void)lines;
+    (void)count;
+    int i = bench_next++ % pack->evidence_count;
+    create_case_file(pack_string(pack_evidence[i].file), pack_string(pack_evidence[i].content));
+}
 
-int main() {
-    char input[MAX_INPUT_SIZE];
-    char *args[MAX_ARGS];
+static void bench_search(char **lines, int count) {
+    SearchIndex *index = &session->store.index;
+    char terms[SEARCH_MAX_TERMS][SEARCH_TERM];
+    while (index->doc_count < SEARCH_BENCH_DOCS) {
+        char text[256];
+        int i = index->doc_count;
+        int len = snprintf(text, sizeof(text), "Report %d: %s was seen near room #%d at the %s.\n%s\n", i,
+                           suspect_name(i % pack->suspect_count), i % 500, location_name(i % pack->location_count),
+                           pack_string(pack_evidence[i % pack->evidence_count].content));
+        EvidenceBlob *blob = evidence_blob(text, len);
+        snprintf(text, sizeof(text), "report%d.txt", i);
+        search_add(index, text, blob, NULL, -1);
+        evidence_release(blob);
+    }
 
-    init_game();
-    create_case_files();
-    print_welcome_message();
+    const char *p = lines[bench_next++ % count], *end = p + strlen(p);
+    int n = 0;
+    while (n < SEARCH_MAX_TERMS && search_word(&p, end, terms[n])) n++;
+    search_run(index, terms, n, &session->game, NULL, NULL);
+}
 
-    while (1) {
-        print_prompt();
-        if (fgets(input, MAX_INPUT_SIZE, stdin) == NULL) break;
-        parse_input(input, args);
-        
-        int i;
-        for (i = 0; args[i] != NULL; i++) {
-            if (strcmp(args[i], "|") == 0) {
-                execute_with_pipe(args);
-                break;
-            }
+static void bench_complete(char **lines, int count) {
+    static Completer words;
+    if (words.count == 0) {
+        for (int i = 0; i < command_count; i++) complete_add(&words, commands[i]->name, COMPLETE_COMMAND);
+        for (unsigned int i = 0; i < pack->suspect_count; i++) {
+            complete_add(&words, pack_string(pack_suspects[i].name), COMPLETE_SUSPECT);
+        }
+        for (unsigned int i = 0; i < pack->location_count; i++) {
+            complete_add(&words, location_name(i), COMPLETE_LOCATION);
         }
-        if (args[i] == NULL) {
-            execute_command(args);
+        while (words.count < COMPLETE_BENCH_WORDS) {
+            char name[64];
+            snprintf(name, sizeof(name), "report%d.txt", words.count);
+            complete_add(&words, name, COMPLETE_FILE);
         }
     }
 
-    return 0;
+    const char *line = lines[bench_next++ % count];
+    char *found[COMPLETE_SHOWN];
+    size_t start, len = strlen(line);
+    int kinds = completion_context(line, len, &start);
+    char *prefix = strndup(line + start, len - start);
+    int n = complete_candidates(&words, prefix, kinds, found, COMPLETE_SHOWN);
+    for (int i = 0; i < n; i++) free(found[i]);
+    free(prefix);
 }
 
-void create_case_file(const char *filename, const char *content) {
-    char path[256];
-    snprintf(path, sizeof(path), "case_files/%s", filename);
-    
-    FILE *fp = fopen(path, "w");
-    if (fp == NULL) {
-        printf("Error creating %s: %s\n", filename, strerror(errno));
-        return;
+static void bench_lines(char **lines, int count) {
+    char buf[MAX_INPUT_SIZE];
+    session->game = bench_start;
+    session->running = 1;
+    for (int i = 0; i < count; i++) {
+        int len = snprintf(buf, sizeof(buf), "%s", lines[i]);
+        if (parse_input(buf, len, &session->tokens) == 0) {
+            run_command_line(session->tokens.argv);
+        }
     }
-    fprintf(fp, "%s", content);
-    fclose(fp);
 }
 
-void init_game() {
-    game.progress = 0;
-    game.evidence_found = 0;
-    
-    strcpy(game.locations[0], "Police Station");
-    strcpy(game.locations[1], "Crime Scene");
-    strcpy(game.locations[2], "Velvet Nightclub");
-    strcpy(game.locations[3], "Docks");
-    strcpy(game.locations[4], "Roosevelt Hotel");
-    strcpy(game.locations[5], "City Morgue");
-    
-    strcpy(game.suspect[0], "Tony 'Fingers' Moretti");
-    strcpy(game.suspect[1], "Victoria 'Vixen' LaRue");
-    strcpy(game.suspect[2], "Big Louie Scaletta");
-    strcpy(game.suspect[3], "Mickey O'Shea");
-    strcpy(game.suspect[4], "Dr. Eleanor Whitmore");
-    strcpy(game.suspect[5], "Sal 'The Tailor' Russo");
-    
-    strcpy(game.suspect_locations[0], "Velvet Nightclub");
-    strcpy(game.suspect_locations[1], "Velvet Nightclub");
-    strcpy(game.suspect_locations[2], "Docks");
-    strcpy(game.suspect_locations[3], "Police Station");
-    strcpy(game.suspect_locations[4], "City Morgue");
-    strcpy(game.suspect_locations[5], "Roosevelt Hotel");
-    
-    strcpy(game.weapon, "a .38 snubnose");
-    strcpy(game.motive, "The victim knew about Victoria's drug operation and was blackmailing her");
-    game.correct_suspect = 1;
-    
-    for (int i = 0; i < 6; i++) {
-        game.interviews_done[i] = 0;
-    }
+static void bench_add_line(Benchmark *bench, const char *fmt, ...) {
+    char line[MAX_INPUT_SIZE];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    bench->lines = realloc(bench->lines, (bench->count + 1) * sizeof(char *));
+    bench->lines[bench->count++] = strdup(line);
 }
 
-void create_case_files() {
-    system("mkdir -p case_files");
+static Benchmark *bench_new(Benchmark **list, int *count, const char *kind, const char *name, BenchOp op) {
+    *list = realloc(*list, (*count + 1) * sizeof(Benchmark));
+    Benchmark *bench = &(*list)[(*count)++];
+    memset(bench, 0, sizeof(*bench));
+    snprintf(bench->name, sizeof(bench->name), "%s", name);
+    bench->kind = kind;
+    bench->op = op;
+    return bench;
 }
 
-void print_prompt() {
-    printf("\033[1;31m[%s] detective@LA-Noire:~$\033[0m ", game.locations[game.progress % 6]);
-    fflush(stdout);
-}
+static int build_benchmarks(Benchmark **list, const char *transcript) {
+    int count = 0;
+    const char *file = pack_string(pack_evidence[0].file);
+    const char *who = suspect_name(0);
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        if (pack_suspects[i].location == 0) {
+            who = suspect_name(i);
+            break;
+        }
+    }
+    const char *where = location_name(1 % pack->location_count);
 
-void parse_input(char *input, char **args) {
-    int i = 0;
-    char *token = strtok(input, " \t\n");
+    Benchmark *b = bench_new(list, &count, "micro", "parse_input", bench_parse);
+    bench_add_line(b, "investigate");
+    bench_add_line(b, "interview %s", pack_string(pack_suspects[0].name));
+    bench_add_line(b, "cat %s | rev > notes.txt", file);
 
-    while (token != NULL && i < MAX_ARGS - 1) {
-        args[i] = token;
-        token = strtok(NULL, " \t\n");
-        i++;
+    b = bench_new(list, &count, "micro", "dispatch", bench_dispatch);
+    for (int i = 0; i < command_count; i++) {
+        bench_add_line(b, "%s", commands[i]->name);
     }
-    args[i] = NULL;
-}
 
-void execute_command(char **args) {
-    if (!args[0]) return;
+    b = bench_new(list, &count, "micro", "resolve", bench_resolve);
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        bench_add_line(b, "%s", pack_string(pack_suspects[i].name));
+        bench_add_line(b, "%.3s", suspect_name(i));
+    }
 
-    for (int i = 0; args[i] != NULL; i++) {
-        if (strcmp(args[i], ">") == 0 && args[i+1] != NULL) {
-            handle_redirection(args);
-            return;
+    bench_new(list, &count, "micro", "create_case_file", bench_create_file);
+
+    b = bench_new(list, &count, "micro", "search", bench_search);
+    bench_add_line(b, "room 47");
+    bench_add_line(b, "%s", suspect_name(0));
+    bench_add_line(b, "report seen room");
+    bench_add_line(b, "%s room 250", location_name(0));
+
+    b = bench_new(list, &count, "micro", "complete", bench_complete);
+    bench_add_line(b, "inv");
+    bench_add_line(b, "interview %.4s", suspect_name(0));
+    bench_add_line(b, "move %.2s", location_name(0));
+    bench_add_line(b, "cat report12");
+
+    const char *builtins[][2] = {
+        {"investigate", "investigate"}, {"interview", "interview %s"}, {"examine", "examine %s"},
+        {"move", "move %s"}, {"whereis", "whereis %s"}, {"status", "status"}, {"save", "save bench"},
+        {"load", "load bench"}, {"ls", "ls"}, {"cat", "cat %s"}, {"rev", "rev %s"}, {"du", "du"},
+        {"date", "date"}, {"mv", "mv %s moved.txt"}, {"help", "help"},
+    };
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        char name[64];
+        const char *arg = "";
+        if (strcmp(builtins[i][0], "interview") == 0 || strcmp(builtins[i][0], "whereis") == 0) arg = who;
+        if (strcmp(builtins[i][0], "examine") == 0) arg = evidence_name(0);
+        if (strcmp(builtins[i][0], "move") == 0) arg = where;
+        if (strcmp(builtins[i][0], "cat") == 0 || strcmp(builtins[i][0], "rev") == 0 || strcmp(builtins[i][0], "mv") == 0) arg = file;
+        snprintf(name, sizeof(name), "builtin/%s", builtins[i][0]);
+        b = bench_new(list, &count, "micro", name, bench_lines);
+        bench_add_line(b, builtins[i][1], arg);
+        if (strcmp(builtins[i][0], "mv") == 0) bench_add_line(b, "mv moved.txt %s", file);
+    }
+
+    b = bench_new(list, &count, "macro", "pipeline", bench_lines);
+    bench_add_line(b, "cat %s | rev", file);
+    b = bench_new(list, &count, "macro", "redirect", bench_lines);
+    bench_add_line(b, "status > notes.txt");
+    bench_add_line(b, "cat < notes.txt > copy.txt");
+
+    b = bench_new(list, &count, "macro", "session", bench_lines);
+    bench_add_line(b, "investigate");
+    bench_add_line(b, "move %s", where);
+    bench_add_line(b, "interview %s", who);
+    bench_add_line(b, "investigate");
+    bench_add_line(b, "examine %s", evidence_name(0));
+    bench_add_line(b, "cat %s | rev", file);
+    bench_add_line(b, "status > notes.txt");
+    bench_add_line(b, "cat < notes.txt");
+    bench_add_line(b, "ls | cat");
+    bench_add_line(b, "whereis %s", who);
+    bench_add_line(b, "investigate");
+    bench_add_line(b, "help");
+
+    if (transcript) {
+        Replay replay;
+        if (load_replay(transcript, &replay)) return -1;
+        b = bench_new(list, &count, "macro", "transcript", bench_lines);
+        for (size_t i = 0; i < replay.count; i++) {
+            const char *name = replay.pool + replay.commands[i].name - 1;
+            const Command *cmd = find_command(name);
+            if (cmd == NULL || (cmd->flags & CMD_LOCAL_ONLY) || strcmp(name, "accuse") == 0 || strcmp(name, "exit") == 0) {
+                continue;
+            }
+            if (replay.commands[i].arg) {
+                bench_add_line(b, "%s %s", name, replay.pool + replay.commands[i].arg - 1);
+            } else {
+                bench_add_line(b, "%s", name);
+            }
         }
+        munmap((void *)replay.data, replay.size);
+        free(replay.pool);
+        free(replay.commands);
+        free(replay.marks);
+        if (b->count == 0) count--;
     }
+    return count;
+}
 
-    if (strcmp(args[0], "investigate") == 0) {
-        handle_investigate();
-    } 
-    else if (strcmp(args[0], "interview") == 0 && args[1]) {
-        handle_interview(args[1]);
+static double bench_syscalls(Benchmark *bench) {
+    int ops = BENCH_TRACE_OPS;
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid == 0) {
+        bench->op(bench->lines, bench->count);
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) _exit(1);
+        raise(SIGSTOP);
+        for (int i = 0; i < ops; i++) {
+            bench->op(bench->lines, bench->count);
+        }
+        _exit(0);
     }
-    else if (strcmp(args[0], "accuse") == 0 && args[1]) {
-        handle_accuse(args[1]);
+
+    pid_t tids[BENCH_TRACE_THREADS];
+    int inside[BENCH_TRACE_THREADS];
+    int threads = 0, stopped = 0, status;
+    long calls = 0;
+    double result = -1;
+    for (;;) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1) break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid != pid) continue;
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                result = (calls - 1) / (double)ops;
+            }
+            break;
+        }
+        int sig = WSTOPSIG(status);
+        if (!stopped) {
+            stopped = 1;
+            ptrace(PTRACE_SETOPTIONS, tid, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+            sig = 0;
+        } else if (sig == (SIGTRAP | 0x80)) {
+            int t = 0;
+            while (t < threads && tids[t] != tid) t++;
+            if (t == threads && threads < BENCH_TRACE_THREADS) {
+                tids[threads] = tid;
+                inside[threads++] = 0;
+            }
+            if (t < threads) {
+                if (!inside[t]) calls++;
+                inside[t] = !inside[t];
+            }
+            sig = 0;
+        } else if (sig == SIGTRAP || sig == SIGSTOP) {
+            sig = 0;
+        }
+        ptrace(PTRACE_SYSCALL, tid, NULL, sig);
     }
-    else if (strcmp(args[0], "examine") == 0 && args[1]) {
-        handle_examine(args[1]);
+    return result;
+}
+
+static void bench_run(Benchmark *bench) {
+    long iterations = 1;
+    unsigned long long elapsed = 0, allocs = 0;
+    bench->op(bench->lines, bench->count);
+    for (;;) {
+        unsigned long long alloc_begin = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+        unsigned long long begin = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            bench->op(bench->lines, bench->count);
+        }
+        elapsed = now_ns() - begin;
+        allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - alloc_begin;
+        if (elapsed >= BENCH_MIN_NS || iterations >= BENCH_MAX_ITERATIONS) break;
+        iterations *= elapsed ? (BENCH_MIN_NS / elapsed > 10 ? 10 : 2) : 10;
     }
-    else if (strcmp(args[0], "move") == 0 && args[1]) {
-        handle_move(args[1]);
+    bench->iterations = iterations;
+    bench->ns_per_op = elapsed / (double)iterations;
+    bench->allocs_per_op = ALLOCS_COUNTED ? allocs / (double)iterations : -1;
+    bench->syscalls_per_op = bench_syscalls(bench);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+void run_bench(const char *filter, const char *output, const char *transcript) {
+    if (job_list != NULL) {
+        /* tracing waits on any child and would reap the jobs */
+        sh_printf("bench: wait for the background jobs to finish first (see 'jobs')\n");
+        return;
     }
-    else if (strcmp(args[0], "whereis") == 0 && args[1]) {
-        handle_whereis(args[1]);
+    Benchmark *list = NULL;
+    int count = build_benchmarks(&list, transcript);
+    if (count < 0) return;
+    int matched = 0;
+    for (int i = 0; i < count; i++) {
+        if (filter == NULL || strstr(list[i].name, filter)) matched++;
     }
-    else if (strcmp(args[0], "status") == 0) {
-        print_case_status();
+    if (matched == 0) {
+        sh_printf("No benchmark matches '%s'. Names:", filter);
+        for (int i = 0; i < count; i++) sh_printf(" %s", list[i].name);
+        sh_printf("\n");
+        count = 0;
     }
-    else if (strcmp(args[0], "help") == 0) {
-        printf("\n\033[1;33mCOMMANDS:\033[0m\n");
-        printf("  investigate - Search for clues\n");
-        printf("  interview [name] - Question suspects\n");
-        printf("  examine [file] - Review evidence\n");
-        printf("  move [location] - Go to another location\n");
-        printf("  whereis [suspect] - Find a suspect's location\n");
-        printf("  accuse [name] - Make your final charge\n");
-        printf("  status - Show case progress\n");
-        printf("  forkbomb - Controlled fork bomb demonstration (10 max)\n");
-        printf("  mv/du/date/rev - Standard Unix commands\n");
-        printf("  ls/cd/cat - Examine files\n");
-        printf("  help - Show this message\n");
-        printf("  exit - Quit the game\n");
-        printf("\n\033[1;33mREDIRECTION:\033[0m\n");
-        printf("  command > file - Redirect output to file\n");
-        printf("  command1 | command2 - Pipe output\n\n");
+    if (count == 0) {
+        free(list);
+        return;
     }
-    else if (strcmp(args[0], "ls") == 0) {
-        system("ls case_files");
+
+    FILE *out = output ? fopen(output, "w") : sh_out;
+    if (out == NULL) {
+        sh_perror(output);
+        return;
     }
-    else if (strcmp(args[0], "cd") == 0 && args[1]) {
-        if (chdir(args[1])) {
-            perror("cd failed");
-        }
+    char dir[] = "/tmp/noire-bench.XXXXXX";
+    int home = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mkdtemp(dir) == NULL || home == -1 || chdir(dir) == -1) {
+        sh_perror("bench");
+        if (home != -1) close(home);
+        if (output) fclose(out);
+        return;
     }
-    else if (strcmp(args[0], "cat") == 0 && args[1]) {
-        char cmd[MAX_INPUT_SIZE];
-        snprintf(cmd, sizeof(cmd), "cat case_files/%s", args[1]);
-        system(cmd);
+
+    evidence_flush(&session->store);
+    Session saved = *session;
+    memset(&session->store, 0, sizeof(session->store));
+    Histogram *saved_histograms = malloc(sizeof(histograms));
+    StatCounters saved_counters = stat_counters;
+    int saved_trace = trace_fd;
+    memcpy(saved_histograms, histograms, sizeof(histograms));
+    trace_fd = -1;
+    FILE *saved_out = sh_out;
+    FILE *saved_err = sh_err;
+    sh_out = fopen("/dev/null", "we");
+    sh_err = sh_out;
+    setvbuf(sh_out, NULL, _IOFBF, 1 << 16);
+    session->journal = -1;
+    session->recorder = NULL;
+    snprintf(session->case_dir, sizeof(session->case_dir), "case_files");
+    create_case_files();
+    memset(&bench_start, 0, sizeof(bench_start));
+    for (unsigned int i = 0; i < pack->evidence_count; i++) {
+        create_case_file(pack_string(pack_evidence[i].file), pack_string(pack_evidence[i].content));
     }
-    else if (strcmp(args[0], "forkbomb") == 0) {
-        controlled_forkbomb();
+    save_snapshot("bench");
+
+    for (int i = 0; i < count; i++) {
+        if (filter && strstr(list[i].name, filter) == NULL) continue;
+        bench_next = 0;
+        bench_run(&list[i]);
+        if (session->journal != -1) {
+            close(session->journal);
+            session->journal = -1;
+        }
     }
-    else if (strcmp(args[0], "mv") == 0 && args[1] && args[2]) {
-        if (rename(args[1], args[2]) == 0) {
-            printf("Moved %s to %s\n", args[1], args[2]);
+
+    fclose(sh_out);
+    evidence_close(&session->store);
+    saved.render = session->render;
+    *session = saved;
+    memcpy(histograms, saved_histograms, sizeof(histograms));
+    free(saved_histograms);
+    stat_counters = saved_counters;
+    trace_fd = saved_trace;
+    sh_out = saved_out;
+    sh_err = saved_err;
+    if (fchdir(home) == -1) sh_perror("bench");
+    close(home);
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    fprintf(out, "{\n  \"case\": \"%s\",\n  \"launcher\": \"%s\",\n  \"results\": [", pack_string(pack->name), launch_mode_names[launch_mode]);
+    for (int i = 0, first = 1; i < count; i++) {
+        if (list[i].iterations == 0) continue;
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"kind\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.1f, \"allocs_per_op\": ",
+                first ? "" : ",", list[i].name, list[i].kind, list[i].iterations, list[i].ns_per_op);
+        if (list[i].allocs_per_op < 0) {
+            fprintf(out, "null, \"syscalls_per_op\": ");
         } else {
-            perror("mv failed");
+            fprintf(out, "%.2f, \"syscalls_per_op\": ", list[i].allocs_per_op);
         }
+        if (list[i].syscalls_per_op < 0) {
+            fprintf(out, "null}");
+        } else {
+            fprintf(out, "%.2f}", list[i].syscalls_per_op);
+        }
+        first = 0;
     }
-    else if (strcmp(args[0], "du") == 0) {
-        system("du -sh case_files");
-    }
-    else if (strcmp(args[0], "date") == 0) {
-        system("date");
-    }
-    else if (strcmp(args[0], "rev") == 0 && args[1]) {
-        char cmd[MAX_INPUT_SIZE];
-        snprintf(cmd, sizeof(cmd), "rev case_files/%s", args[1]);
-        system(cmd);
-    }
-    else if (strcmp(args[0], "execdemo") == 0) {
-        demonstrate_exec();
-    }
-    else if (strcmp(args[0], "waitdemo") == 0) {
-        demonstrate_waitpid();
-    }
-    else if (strcmp(args[0], "execvpdemo") == 0) {
-        demonstrate_execvp();
-    }
-    else if (strcmp(args[0], "exit") == 0) {
-        printf("\nCase abandoned. The streets remain unsafe...\n");
-        exit(0);
+    fprintf(out, "\n  ]\n}\n");
+    if (output) {
+        fclose(out);
+        sh_printf("Wrote %d benchmark results to %s\n", matched, output);
     }
-    else {
-        printf("Command not recognized. Type 'help' for options.\n");
+
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < list[i].count; j++) free(list[i].lines[j]);
+        free(list[i].lines);
     }
+    free(list);
 }
 
-void handle_redirection(char **args) {
-    int i;
-    for (i = 0; args[i] != NULL; i++) {
-        if (strcmp(args[i], ">") == 0) {
-            break;
+void cmd_bench(char **args) {
+    const char *filter = args[1] && strcmp(args[1], "all") != 0 ? args[1] : NULL;
+    run_bench(filter, args[1] ? args[2] : NULL, args[1] && args[2] ? args[3] : NULL);
+}
+
+static int hist_bucket(unsigned long long value) {
+    if (value < HIST_SUB) return value;
+    int msb = 63 - __builtin_clzll(value);
+    if (msb > HIST_MAX_BIT) return HIST_BUCKETS - 1;
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + ((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static unsigned long long hist_value(int bucket) {
+    if (bucket < HIST_SUB) return bucket;
+    int shift = bucket / HIST_SUB - 1;
+    unsigned long long low = (unsigned long long)(HIST_SUB + bucket % HIST_SUB) << shift;
+    return low + ((1ull << shift) >> 1);
+}
+
+static unsigned long long hist_percentile(const Histogram *hist, int percent) {
+    unsigned long long target = (hist->count * percent + 99) / 100;
+    unsigned long long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            unsigned long long value = hist_value(i);
+            return value < hist->max ? value : hist->max;
         }
     }
-    
-    if (args[i] == NULL || args[i+1] == NULL) {
-        printf("Invalid redirection syntax\n");
-        return;
+    return hist->max;
+}
+
+static void trace_event(const char *name, const char *category, unsigned long long begin, unsigned long long end) {
+    static __thread long tid;
+    char event[512];
+    if (tid == 0) tid = syscall(SYS_gettid);
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd != -1 && begin >= trace_epoch) {
+        int len = snprintf(event, sizeof(event), "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+                           "\"dur\": %.3f, \"pid\": %d, \"tid\": %ld, \"args\": {\"session\": %lu}}",
+                           trace_events++ ? ",\n" : "\n", name, category, (begin - trace_epoch) / 1e3,
+                           (end - begin) / 1e3, getpid(), tid, session ? session->id : 0);
+        write_all(trace_fd, event, len);
     }
-    
-    args[i] = NULL;
-    int fd = open(args[i+1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd == -1) {
-        perror("open failed");
-        return;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void stat_record(int slot, const char *name, unsigned long long begin) {
+    unsigned long long end = now_ns();
+    unsigned long long elapsed = end - begin;
+    Histogram *hist = &histograms[slot];
+
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->buckets[hist_bucket(elapsed)], 1, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (elapsed > max && !__atomic_compare_exchange_n(&hist->max, &max, elapsed, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
     }
-    
-    pid_t pid = fork();
-    if (pid == 0) {
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
-        execute_command(args);
-        exit(0);
-    } else if (pid > 0) {
-        close(fd);
-        wait(NULL);
-    } else {
-        perror("fork failed");
+    if (__atomic_load_n(&trace_fd, __ATOMIC_RELAXED) != -1) {
+        trace_event(name, slot < MAX_COMMANDS ? "command" : "shell", begin, end);
     }
 }
 
-void execute_with_pipe(char **args) {
-    int i;
-    for (i = 0; args[i] != NULL; i++) {
-        if (strcmp(args[i], "|") == 0) {
-            break;
-        }
+int command_slot(const Command *cmd) {
+    for (int i = 0; i < command_count; i++) {
+        if (commands[i] == cmd) return i;
     }
-    
-    if (args[i] == NULL || args[i+1] == NULL) {
-        printf("Invalid pipe syntax\n");
-        return;
+    return -1;
+}
+
+static void print_histogram(const char *name, const Histogram *hist) {
+    if (hist->count == 0) return;
+    sh_printf("  %-14s %8llu %10.1f %10.1f %10.1f %10.1f\n", name, hist->count,
+              hist->total / 1e3 / hist->count, hist_percentile(hist, 50) / 1e3,
+              hist_percentile(hist, 99) / 1e3, hist->max / 1e3);
+}
+
+void print_stats() {
+    sh_printf("\n");
+    sh_styled(STYLE_HEADING, "SHELL STATS:");
+    sh_printf(" startup %.1f ms (launch to first prompt)\n", startup_ns / 1e6);
+    sh_printf("  %-14s %8s %10s %10s %10s %10s\n", "command", "count", "mean", "p50", "p99", "max");
+    for (int i = 0; i < command_count; i++) {
+        print_histogram(commands[i]->name, &histograms[i]);
     }
-    
-    char *cmd1[MAX_ARGS];
-    char *cmd2[MAX_ARGS];
-    
-    memcpy(cmd1, args, i * sizeof(char*));
-    cmd1[i] = NULL;
-    
-    memcpy(cmd2, &args[i+1], (MAX_ARGS - i - 1) * sizeof(char*));
-    
-    int pipefd[2];
-    if (pipe(pipefd)) {
-        perror("pipe failed");
-        return;
+    for (int i = STAT_PIPELINE; i < STAT_SLOTS; i++) {
+        print_histogram(stat_phase_names[i - STAT_PIPELINE], &histograms[i]);
     }
-    
-    pid_t pid1 = fork();
-    if (pid1 == 0) {
-        close(pipefd[0]);
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[1]);
-        execute_command(cmd1);
-        exit(0);
+    sh_printf("  (latencies in microseconds; p50/p99 accurate to about 3%%)\n");
+    sh_printf("  forks %llu, execs %llu, bytes read %llu, bytes written %llu, files created %llu\n",
+              stat_counters.forks, stat_counters.execs, stat_counters.bytes_read,
+              stat_counters.bytes_written, stat_counters.files_created);
+    pthread_mutex_lock(&dialogue_lock);
+    unsigned int loaded = 0;
+    for (unsigned int i = 0; i < pack->suspect_count; i++) {
+        loaded += dialogue_trees[i] != NULL;
     }
-    
-    pid_t pid2 = fork();
-    if (pid2 == 0) {
-        close(pipefd[1]);
-        dup2(pipefd[0], STDIN_FILENO);
-        close(pipefd[0]);
-        execute_command(cmd2);
-        exit(0);
+    sh_printf("  dialogue trees loaded for %u of %u suspects, %zu nodes in %zu bytes of arena\n\n",
+              loaded, pack->suspect_count, dialogue_arena.objects, dialogue_arena.bytes);
+    pthread_mutex_unlock(&dialogue_lock);
+}
+
+int trace_start(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        sh_perror(path);
+        return -1;
     }
-    
-    close(pipefd[0]);
-    close(pipefd[1]);
-    waitpid(pid1, NULL, 0);
-    waitpid(pid2, NULL, 0);
+    trace_stop();
+    pthread_mutex_lock(&trace_lock);
+    write_all(fd, "[", 1);
+    trace_events = 0;
+    trace_epoch = now_ns();
+    __atomic_store_n(&trace_fd, fd, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
 }
 
-void demonstrate_exec() {
-    printf("\nDemonstrating exec() system call:\n");
-    pid_t pid = fork();
-    if (pid == 0) {
-        printf("Child process will now execute 'ls case_files'\n");
-        execlp("ls", "ls", "case_files", NULL);
-        perror("exec failed");
-        exit(1);
-    } else if (pid > 0) {
-        wait(NULL);
-        printf("Parent process continuing\n\n");
-    } else {
-        perror("fork failed");
+void trace_stop() {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd != -1) {
+        write_all(trace_fd, "\n]\n", 3);
+        close(trace_fd);
+        __atomic_store_n(&trace_fd, -1, __ATOMIC_RELAXED);
     }
+    pthread_mutex_unlock(&trace_lock);
 }
 
-void demonstrate_waitpid() {
-    printf("\nDemonstrating waitpid() system call:\n");
-    pid_t pid = fork();
-    if (pid == 0) {
-        printf("Child process working...\n");
-        sleep(2);
-        printf("Child process done\n");
-        exit(42);
-    } else if (pid > 0) {
-        int status;
-        waitpid(pid, &status, 0);
-        if (WIFEXITED(status)) {
-            printf("Child exited with status: %d\n\n", WEXITSTATUS(status));
-        }
-    } else {
-        perror("fork failed");
+void cmd_stats(char **args) {
+    if (args[1] && strcmp(args[1], "reset") == 0) {
+        memset(histograms, 0, sizeof(histograms));
+        memset(&stat_counters, 0, sizeof(stat_counters));
+        sh_printf("Stats cleared\n");
+        return;
     }
+    print_stats();
 }
 
-void demonstrate_execvp() {
-    printf("\nDemonstrating execvp() system call:\n");
-    char *argv[] = {"ls", "-l", "case_files", NULL};
-    
-    pid_t pid = fork();
-    if (pid == 0) {
-        printf("Child will now execute 'ls -l case_files'\n");
-        execvp("ls", argv);
-        perror("execvp failed");
-        exit(1);
-    } else if (pid > 0) {
-        wait(NULL);
-        printf("Parent process continuing\n\n");
+void cmd_trace(char **args) {
+    if (args[1] && strcmp(args[1], "on") == 0) {
+        const char *path = args[2] ? args[2] : "noire-trace.json";
+        if (trace_start(path) == 0) {
+            sh_printf("Tracing to %s (open it in chrome://tracing or Perfetto)\n", path);
+        }
+    } else if (args[1] && strcmp(args[1], "off") == 0) {
+        trace_stop();
+        sh_printf("Tracing stopped\n");
     } else {
-        perror("fork failed");
+        sh_printf("Tracing is %s. Usage: trace on [file] | trace off\n", trace_fd != -1 ? "on" : "off");
     }
 }
 
-void controlled_forkbomb() {
-    printf("\n\033[1;31mCONTROLLED FORKBOMB DEMONSTRATION\033[0m\n");
-    printf("This will create 10 processes then stop automatically\n");
-    printf("All processes will terminate after 2 seconds\n");
-    
-    for (int i = 0; i < 10; i++) {
-        if (fork() == 0) {
-            printf("Fork bomb child %d created (PID: %d)\n", i+1, getpid());
-            sleep(2);
-            exit(0);
+static void remove_case_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *entry;
+        char path[512];
+        while ((entry = readdir(d)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(path);
         }
+        closedir(d);
+    }
+    rmdir(dir);
+    char parent[128];
+    snprintf(parent, sizeof(parent), "%s", dir);
+    char *slash = strrchr(parent, '/');
+    if (slash) {
+        *slash = '\0';
+        rmdir(parent);
     }
-    
-    sleep(3);
-    printf("\nFork bomb test complete. System stable.\n\n");
 }
 
-void handle_investigate() {
-    char *clues[] = {
-        "You find %s under the victim's body",
-        "The victim's %s shows suspicious entries",
-        "A %s contains damning evidence",
-        "The %s tells a revealing story",
-        "You discover %s in the victim's coat pocket",
-        "The %s reveals critical details"
-    };
-
-    char *discoveries[] = {
-        game.weapon,
-        "ledger (type 'examine ledger')",
-        "ballistics report (type 'examine ballistics')",
-        "witness statement (type 'examine witness')",
-        "hotel key (type 'examine hotel_key')",
-        "toxicology report (type 'examine tox_report')"
-    };
+static Session *session_open(int fd, unsigned long id) {
+    Session *s = calloc(1, sizeof(Session));
+    if (s == NULL) return NULL;
 
-    switch(game.progress) {
-        case 0:
-            create_case_file("ledger.txt", "Last entry: Owes $5000 to Vixen");
-            break;
-        case 1:
-            create_case_file("ballistics.txt", "Fingerprint match: V. LaRue");
-            break;
-        case 2:
-            create_case_file("witness.txt", "10pm: Heard arguing near dumpsters\n11:30pm: Gunshot heard");
-            break;
-        case 3:
-            create_case_file("forensics.txt", "Victim had traces of lipstick on collar (shade matches Victoria)");
-            break;
-        case 4:
-            create_case_file("hotel_key.txt", "Hotel Key #47 found in victim's pocket (Roosevelt Hotel)");
-            break;
-        case 5:
-            create_case_file("tox_report.txt", "Toxicology: High levels of barbiturates in victim's system");
-            break;
+    s->fd = fd;
+    s->id = id;
+    s->remote = 1;
+    s->journal = -1;
+    s->running = 1;
+    s->outcome = CASE_OPEN;
+    s->use_color = 1;
+    s->show_prompt = 1;
+    s->out = session_stream(s);
+    s->incap = MAX_INPUT_SIZE;
+    s->inbuf = malloc(s->incap);
+    snprintf(s->case_dir, sizeof(s->case_dir), "%s/%lu/case_files", SESSION_ROOT, id);
+    if (s->out == NULL || s->inbuf == NULL) {
+        if (s->out) fclose(s->out);
+        free(s->inbuf);
+        free(s);
+        return NULL;
     }
 
-    printf("\n\033[1;33m=== Crime Scene Report ===\033[0m\n");
-    printf(clues[game.progress], discoveries[game.progress]);
-    printf("\n\033[1;33m=========================\033[0m\n\n");
+    char dir[128];
+    snprintf(dir, sizeof(dir), "%s/%lu", SESSION_ROOT, id);
+    mkdir(SESSION_ROOT, 0755);
+    mkdir(dir, 0700);
+    return s;
+}
 
-    game.progress++;
-    game.evidence_found++;
-    if (game.progress > 5) {
-        printf("\033[1;32mYou've found all the evidence! Time to accuse a suspect.\033[0m\n");
-    }
+static void session_close(Session *s) {
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    fclose(s->out);
+    evidence_close(&s->store);
+    remove_case_dir(s->case_dir);
+    free(s->render.text);
+    free(s->render.segs);
+    free(s->inbuf);
+    free(s->tokens.argv);
+    free(s);
 }
 
-void handle_interview(char *suspect) {
-    char *responses[6][3] = {
-        {"I was playing poker at the Tropicana!", "Me? Hurt someone? I'm a lover, not a fighter!", "Victoria? She's been acting real jumpy lately..."},
-        {"I was home alone all night", "I don't know what you're implying!", "*nervously checks watch*"},
-        {"I was unloading cargo, ask my crew", "The victim? Never liked him, but I didn't kill him", "Tony's been desperate for money..."},
-        {"I was tending bar all night", "That gun ain't mine, copper!", "Victoria's been dealing under the table..."},
-        {"Time of death was approximately 11:15pm", "The wound shows signs of a close-range shot", "Victoria came by earlier asking about sedatives..."},
-        {"Johnny owed me rent for three months!", "Room #47 was his usual spot with... certain ladies", "I heard Victoria threatened him last week"}
-    };
+static void session_enter(Session *s) {
+    session = s;
+    sh_in = server_null_in;
+    sh_out = s->out;
+    sh_err = s->out;
+}
+
+static int session_flush(Session *s) {
+    fflush(s->out);
+    if (render_write(&s->render, s->fd)) return -1;
 
-    int found = -1;
-    for (int i = 0; i < 6; i++) {
-        if (strstr(game.suspect[i], suspect)) {
-            found = i;
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLRDHUP | (s->render.len ? EPOLLOUT : 0);
+    ev.data.ptr = s;
+    epoll_ctl(s->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+    return 0;
+}
+
+static void session_run_lines(Session *s) {
+    size_t pos = 0;
+    session_enter(s);
+    while (s->running && s->render.len < SESSION_HIGH_WATER) {
+        char *line = s->inbuf + pos;
+        size_t left = s->inlen - pos;
+        char *newline = memchr(line, '\n', left);
+        if (newline == NULL) {
+            if (left < SESSION_MAX_LINE && !s->discarding) break;
+            if (!s->discarding) {
+                sh_printf("Input line too long (limit %d bytes).\n", SESSION_MAX_LINE);
+                s->discarding = 1;
+            }
+            pos = s->inlen;
             break;
         }
-    }
 
-    if (found >= 0) {
-        if (strcmp(game.locations[game.progress % 6], game.suspect_locations[found]) != 0) {
-            printf("\n%s isn't here. Try 'whereis %s' to find them.\n", game.suspect[found], game.suspect[found]);
-            return;
-        }
-        
-        printf("\n\033[1;36m%s's responses:\033[0m\n", game.suspect[found]);
-        for (int j = 0; j < 3; j++) {
-            printf("- %s\n", responses[found][j]);
+        size_t len = newline - line;
+        pos += len + 1;
+        if (s->discarding) {
+            s->discarding = 0;
+            if (s->running) print_prompt();
+            continue;
         }
-        
-        if (found == game.correct_suspect) {
-            printf("\033[1;31mYou notice her hands shaking...\033[0m\n");
+        *newline = '\0';
+        if (parse_input(line, len, &s->tokens) == 0) {
+            run_command_line(s->tokens.argv);
         }
-        
-        if (!game.interviews_done[found]) {
-            game.interviews_done[found] = 1;
-            printf("\n\033[1;32m(New information added to your notes)\033[0m\n");
-            
-            if (found == 4) {
-                printf("\033[1;33m(Note: Check tox_report.txt for details on sedatives)\033[0m\n");
-            }
-            else if (found == 5) {
-                printf("\033[1;33m(Note: Examine hotel_key.txt about Room #47)\033[0m\n");
-            }
+        if (s->running) {
+            print_prompt();
         }
-    } else {
-        printf("No suspect by that name. Try: Tony, Victoria, Louie, Mickey, Eleanor, Sal\n");
-    }
-}
-
-void handle_examine(char *item) {
-    if (strcmp(item, "ledger") == 0) {
-        system("cat case_files/ledger.txt");
-        printf("\n\033[1;33mNote: Large payment to 'Vixen' noted\033[0m\n");
-    }
-    else if (strcmp(item, "ballistics") == 0) {
-        system("cat case_files/ballistics.txt");
-        printf("\n\033[1;33mNote: Gun registered to Victoria LaRue\033[0m\n");
     }
-    else if (strcmp(item, "witness") == 0) {
-        system("cat case_files/witness.txt");
-        printf("\n\033[1;33mNote: Timeline matches Victoria's alibi gap\033[0m\n");
+    if (pos > 0) {
+        memmove(s->inbuf, s->inbuf + pos, s->inlen - pos);
+        s->inlen -= pos;
     }
-    else if (strcmp(item, "forensics") == 0) {
-        system("cat case_files/forensics.txt");
-        printf("\n\033[1;33mNote: Victoria was seen with victim before murder\033[0m\n");
-    }
-    else if (strcmp(item, "hotel_key") == 0) {
-        system("cat case_files/hotel_key.txt");
-        printf("\n\033[1;33mNote: Connects victim to Roosevelt Hotel\033[0m\n");
-    }
-    else if (strcmp(item, "tox_report") == 0) {
-        system("cat case_files/tox_report.txt");
-        printf("\n\033[1;33mNote: Matches Victoria's access to sedatives\033[0m\n");
-    }
-    else {
-        printf("No evidence by that name. Try: ledger, ballistics, witness, forensics, hotel_key, tox_report\n");
+    if (!s->running) {
+        s->closing = 1;
     }
 }
 
-void handle_move(char *location) {
-    int found = -1;
-    for (int i = 0; i < 6; i++) {
-        if (strstr(game.locations[i], location)) {
-            found = i;
-            break;
-        }
-    }
-    
-    if (found >= 0) {
-        game.progress = found;
-        printf("\nMoved to %s\n", game.locations[game.progress]);
-        
-        printf("\nPeople here:\n");
-        int anyone_here = 0;
-        for (int i = 0; i < 6; i++) {
-            if (strcmp(game.locations[game.progress], game.suspect_locations[i]) == 0) {
-                printf("- %s\n", game.suspect[i]);
-                anyone_here = 1;
+static void session_readable(Session *s) {
+    for (;;) {
+        if (s->inlen + 1 >= s->incap) {
+            session_run_lines(s);
+            if (s->inlen + 1 >= s->incap) {
+                if (s->incap > SESSION_MAX_LINE) break;
+                char *grown = realloc(s->inbuf, s->incap * 2);
+                if (grown == NULL) break;
+                s->inbuf = grown;
+                s->incap *= 2;
             }
         }
-        if (!anyone_here) {
-            printf("No suspects present\n");
-        }
-        
-        if (found == 4) {
-            printf("\n\033[1;33m(A worn ledger sits at the front desk)\033[0m\n");
+        ssize_t n = read(s->fd, s->inbuf + s->inlen, s->incap - 1 - s->inlen);
+        if (n > 0) {
+            s->inlen += n;
+            continue;
         }
-        else if (found == 5) {
-            printf("\n\033[1;33m(The smell of antiseptic hangs in the air)\033[0m\n");
+        if (n == 0) {
+            s->closing = 1;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            s->closing = 1;
         }
-    } else {
-        printf("Invalid location. Choose from: Police Station, Crime Scene, Velvet Nightclub, Docks, Roosevelt Hotel, City Morgue\n");
+        break;
     }
+    session_run_lines(s);
 }
 
-void handle_whereis(char *suspect) {
-    int found = -1;
-    for (int i = 0; i < 6; i++) {
-        if (strstr(game.suspect[i], suspect)) {
-            found = i;
-            break;
+static void *server_worker(void *arg) {
+    int epfd = (int)(long)arg;
+    struct epoll_event events[SERVER_EVENTS];
+
+    for (;;) {
+        int n = epoll_wait(epfd, events, SERVER_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return NULL;
+        }
+        for (int i = 0; i < n; i++) {
+            Session *s = events[i].data.ptr;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                session_readable(s);
+            } else if (s->render.len < SESSION_HIGH_WATER) {
+                session_run_lines(s);
+            }
+            if (session_flush(s) || (s->closing && s->render.len == 0)) {
+                session_close(s);
+            }
         }
     }
-    
-    if (found >= 0) {
-        printf("\n%s is at the %s\n", game.suspect[found], game.suspect_locations[found]);
-    } else {
-        printf("No suspect by that name. Try: Tony, Victoria, Louie, Mickey, Eleanor, Sal\n");
-    }
+    return NULL;
 }
 
-void print_case_status() {
-    printf("\n\033[1;35m=== CASE STATUS ===\033[0m\n");
-    printf("Evidence found: %d/6\n", game.evidence_found);
-    printf("Suspects interviewed:\n");
-    for (int i = 0; i < 6; i++) {
-        printf("- %s: %s\n", game.suspect[i], 
-               game.interviews_done[i] ? "Interviewed" : "Not interviewed");
+static void server_stop(int sig) {
+    if (trace_fd != -1) {
+        write_all(trace_fd, "\n]\n", 3);
     }
-    printf("\nUse 'examine' to review evidence files\n");
-    printf("\033[1;35m==================\033[0m\n\n");
+    unlink(server_socket_path);
+    rmdir(SESSION_ROOT);
+    _exit(128 + sig);
 }
 
-void handle_accuse(char *suspect) {
-    int correct = 0;
-    for (int i = 0; i < 6; i++) {
-        if (strstr(game.suspect[i], suspect)) {
-            correct = (i == game.correct_suspect);
-            break;
-        }
+int run_server(const char *path, int workers) {
+    struct sockaddr_un addr = {0};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 1;
+    }
+    if (workers < 1) {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers < 1) workers = 1;
     }
-    print_ending(correct);
-    exit(0);
-}
 
-void print_ending(int correct) {
-    if (correct) {
-        printf("\n\033[1;32m**** CASE SOLVED ****\n");
-        printf("Victoria 'Vixen' LaRue confesses!\n\n");
-        printf("Weapon: %s\n", game.weapon);
-        printf("Motive: %s\n", game.motive);
-        printf("\nThe Chief hands you your gold detective shield.\033[0m\n");
-    } else {
-        printf("\n\033[1;31m**** CASE CLOSED - UNSOLVED ****\n");
-        printf("The real killer walks free...\n");
-        printf("Internal Affairs has suspended you.\033[0m\n");
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1) {
+        perror("socket");
+        return 1;
     }
-}
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listener, SOMAXCONN) == -1) {
+        perror(path);
+        close(listener);
+        return 1;
+    }
+    snprintf(server_socket_path, sizeof(server_socket_path), "%s", path);
+    signal(SIGINT, server_stop);
+    signal(SIGTERM, server_stop);
 
-void print_welcome_message() {
-    printf("\n\033[1;34m========================================\n");
-    printf("         LA NOIRE MURDER MYSTERY         \n");
-    printf("========================================\n");
-    printf("October 1947. A gunshot echoes through\n");
-    printf("the foggy streets. Another body in the\n");
-    printf("war between the gangs and the vice lords.\n\n");
-    printf("\033[1;31mVICTIM: Johnny 'Rats' Malone\033[0m\n");
-    printf("\033[1;33mSUSPECTS:\033[0m\n");
-    printf("- Tony 'Fingers' Moretti (bookie)\n");
-    printf("- Victoria 'Vixen' LaRue (club owner)\n");
-    printf("- Big Louie Scaletta (dock worker)\n");
-    printf("- Mickey O'Shea (bartender)\n");
-    printf("- Dr. Eleanor Whitmore (medical examiner)\n");
-    printf("- Sal 'The Tailor' Russo (hotel owner)\n");
-    printf("\033[1;34m========================================\033[0m\n\n");
+    server_null_in = fopen("/dev/null", "re");
+    int *epfds = malloc(workers * sizeof(int));
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        epfds[i] = epoll_create1(EPOLL_CLOEXEC);
+        if (epfds[i] == -1 || pthread_create(&thread, NULL, server_worker, (void *)(long)epfds[i])) {
+            perror("worker");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    printf("Detective server listening on %s with %d worker%s\n", path, workers, workers == 1 ? "" : "s");
+    fflush(stdout);
+
+    unsigned long next_id = 1;
+    for (int next = 0; ; next = (next + 1) % workers) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                usleep(10000);
+                continue;
+            }
+            perror("accept");
+            continue;
+        }
+
+        Session *s = session_open(fd, next_id++);
+        if (s == NULL) {
+            close(fd);
+            continue;
+        }
+        s->epfd = epfds[next];
+        session_enter(s);
+        init_game();
+        create_case_files();
+        print_welcome_message();
+        print_prompt();
+        fflush(s->out);
+
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+        ev.data.ptr = s;
+        if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            perror("epoll_ctl");
+            session_close(s);
+        }
+    }
+    return 0;
 }
@@ -0,0 +1,17 @@
+# Builtin pipeline stages run on threads; each one is recorded. The transcript
+# must survive thousands of concurrent stage records and replay completely.
+{
+    echo "record t.bin"
+    echo "investigate"
+    i=0
+    while [ $i -lt 3000 ]; do
+        echo "date | rev | cat | rev > /dev/null"
+        i=$((i + 1))
+    done
+    echo "record stop"
+    echo "replay t.bin"
+} > script.txt
+"$NOIRE_SHELL" -f script.txt > out.txt 2>&1
+grep -q "Recorded 12002 commands" out.txt &&
+    grep -q "Replayed t.bin to step 12002 of 12002" out.txt &&
+    ! grep -q damaged out.txt || { tail -5 out.txt; exit 1; }
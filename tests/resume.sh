@@ -0,0 +1,9 @@
+# A save starts a fresh journal; --resume restores the slot and replays the
+# commands journaled after it.
+printf 'investigate\nsave first\ninvestigate\ninterview Tony\n' > play.txt
+printf 'status\n' > check.txt
+"$NOIRE_SHELL" -f play.txt > /dev/null 2>&1
+"$NOIRE_SHELL" --resume -f check.txt > out.txt 2>&1
+grep -q "Resumed case from slot 'first' with 2 journaled commands" out.txt &&
+    grep -q "Evidence found: 2/" out.txt &&
+    grep -q "Tony 'Fingers' Moretti: Interviewed" out.txt || { cat out.txt; exit 1; }
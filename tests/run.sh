@@ -0,0 +1,40 @@
+#!/bin/sh
+# Runs every tests/*.txt script through the shell in batch mode and compares the
+# output (stdout, then stderr) with tests/*.expected, then runs every tests/*.sh scenario.
+# Usage: tests/run.sh [path/to/OS-Noire-Shell]   (set UPDATE=1 to rewrite .expected)
+
+dir=$(cd "$(dirname "$0")" && pwd)
+shell=$(cd "$(dirname "${1:-$dir/../OS-Noire-Shell}")" && pwd)/$(basename "${1:-OS-Noire-Shell}")
+export NOIRE_SHELL="$shell" NO_COLOR=1 NOIRE_HISTORY=/dev/null
+failed=0
+
+for script in "$dir"/*.txt; do
+    [ -e "$script" ] || continue
+    name=$(basename "$script" .txt)
+    work=$(mktemp -d)
+    (cd "$work" && "$shell" -f "$script" > stdout 2> stderr; echo "exit $?" >> stdout
+     cat stdout; [ -s stderr ] && echo "--- stderr" && cat stderr) | sed -E -f "$dir/normalize.sed" > "$work/actual"
+    if [ -n "$UPDATE" ]; then
+        cp "$work/actual" "$dir/$name.expected"
+    elif ! diff -u "$dir/$name.expected" "$work/actual"; then
+        echo "FAIL $name"
+        failed=1
+    else
+        echo "ok   $name"
+    fi
+    rm -rf "$work"
+done
+
+for test in "$dir"/*.sh; do
+    name=$(basename "$test" .sh)
+    [ "$name" = run ] && continue
+    work=$(mktemp -d)
+    if (cd "$work" && sh "$test"); then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        failed=1
+    fi
+    rm -rf "$work"
+done
+exit $failed
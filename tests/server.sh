@@ -0,0 +1,26 @@
+# A server session may only read its own case files: paths that climb out of
+# sessions/<id>/case_files, or absolute ones, must be refused without leaking.
+echo "TOP SECRET" > secret.txt
+"$NOIRE_SHELL" --server noire.sock --workers 1 > server.log 2>&1 &
+server=$!
+trap 'kill $server 2> /dev/null' EXIT
+i=0
+while [ ! -S noire.sock ] && [ $i -lt 50 ]; do sleep 0.1; i=$((i + 1)); done
+python3 - > out.txt <<'PY' || exit 1
+import socket, sys
+client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+client.connect("noire.sock")
+client.sendall(b"cat ../../../secret.txt\nrev ../../../secret.txt\ncat /etc/hostname\n"
+               b"cat ../../../secret.txt | rev\nexamine ledger\nexit\n")
+client.settimeout(10)
+data = b""
+while True:
+    chunk = client.recv(65536)
+    if not chunk:
+        break
+    data += chunk
+sys.stdout.write(data.decode(errors="replace"))
+PY
+refused=$(grep -c "only case file names are allowed" out.txt)
+[ "$refused" -eq 4 ] && ! grep -q "TOP SECRET\|TERCES POT" out.txt && ! grep -q "sessions/" out.txt ||
+    { cat out.txt; exit 1; }
@@ -0,0 +1,10 @@
+# The solver's script must close every case it is given: the built-in case
+# and a run of generated ones.
+"$NOIRE_SHELL" --solve built-in.txt > /dev/null 2>&1 || exit 1
+"$NOIRE_SHELL" -f built-in.txt > /dev/null 2>&1 || { echo "built-in case not solved"; exit 1; }
+seed=1
+while [ $seed -le 20 ]; do
+    "$NOIRE_SHELL" --random $seed --solve seed.txt > /dev/null 2>&1 || { echo "seed $seed: solver failed"; exit 1; }
+    "$NOIRE_SHELL" --random $seed -f seed.txt > /dev/null 2>&1 || { echo "seed $seed: script did not close the case"; exit 1; }
+    seed=$((seed + 1))
+done